@@ -2,11 +2,39 @@
 // Created by Finaris on 11/25/19.
 //
 
+#include <algorithm>
 #include <functional>
+#include <vector>
 
 #ifndef METROCASTER_ITERATOR_H
 #define METROCASTER_ITERATOR_H
 
 void parallel_for(unsigned n_elements, const std::function<void(int start, int end)>& func, bool parallelize=true);
 
+// Reduces [0, n_elements) in fixed blocks of `grain` elements. Each block's
+// partial result lands in its own slot, and the slots are combined in block
+// order on the calling thread, so the result is the same with or without
+// parallelize and on any number of threads.
+template <typename T>
+T parallel_reduce(unsigned n_elements, unsigned grain, const T &identity,
+                  const std::function<T(int start, int end)>& func,
+                  const std::function<T(const T &a, const T &b)>& combine,
+                  bool parallelize=true) {
+    unsigned n_blocks = (n_elements + grain - 1) / grain;
+    std::vector<T> partials(n_blocks, identity);
+    parallel_for(n_blocks, [&](int first, int last) {
+        for (int block = first; block < last; ++block) {
+            unsigned start = block * grain;
+            unsigned end = std::min(start + grain, n_elements);
+            partials[block] = func(start, end);
+        }
+    }, parallelize);
+
+    T result = identity;
+    for (const T &partial : partials) {
+        result = combine(result, partial);
+    }
+    return result;
+}
+
 #endif // METROCASTER_ITERATOR_H
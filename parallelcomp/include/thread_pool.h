@@ -0,0 +1,65 @@
+#ifndef METROCASTER_THREAD_POOL_H
+#define METROCASTER_THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent pool of worker threads with one task deque per worker.
+// A worker pushes and pops its own tasks at the back of its deque and steals
+// from the front of the other deques once its own runs dry. Tasks submitted
+// from outside the pool land in a shared deque that every worker steals from.
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned n_workers);
+
+    ~ThreadPool();
+
+    // Process-wide pool sized to the hardware, created on first use.
+    static ThreadPool &instance();
+
+    // Number of threads that execute tasks, counting the waiting caller.
+    unsigned concurrency() const {
+        return (unsigned) _workers.size() + 1;
+    }
+
+    // Queue a task. Called from a worker, the task goes onto that worker's
+    // own deque, so nested work stays local until somebody steals it.
+    void submit(std::function<void()> task);
+
+    // Run tasks until the counter drops to zero. The calling thread helps
+    // with queued work instead of blocking, which keeps nested waits from
+    // starving the pool.
+    void wait(const std::atomic<unsigned> &pending);
+
+private:
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void workerLoop(unsigned index);
+
+    // Pop from the calling worker's own deque, or steal from another one.
+    bool runPendingTask();
+
+    bool popLocal(unsigned index, std::function<void()> &task);
+
+    bool steal(unsigned thief, std::function<void()> &task);
+
+    std::vector<std::thread> _workers;
+    // One deque per worker, plus a trailing one for external submissions.
+    std::vector<std::unique_ptr<WorkQueue>> _queues;
+
+    std::mutex _sleep_mutex;
+    std::condition_variable _wake;
+    std::atomic<unsigned> _queued;
+    bool _stop;
+};
+
+#endif // METROCASTER_THREAD_POOL_H
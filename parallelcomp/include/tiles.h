@@ -0,0 +1,48 @@
+#ifndef METROCASTER_TILES_H
+#define METROCASTER_TILES_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// Order in which image tiles are handed out to the workers.
+enum class TileOrder {
+    Scanline,   // row by row, left to right
+    Morton,     // Z-order curve over the tile grid
+    Hilbert,    // Hilbert curve over the tile grid
+    CenterOut,  // nearest to the image center first
+};
+
+// Parses "scanline", "morton", "hilbert" or "center"; returns false otherwise.
+bool tileOrderFromName(const std::string &name, TileOrder &order);
+
+// A rectangle of pixels, half-open: [x0, x1) x [y0, y1).
+struct Tile {
+    int x0, y0;
+    int x1, y1;
+};
+
+// Splits an image into square tiles and dispatches them dynamically: every
+// worker of the thread pool pulls the next tile in the chosen order as soon
+// as it finishes its previous one, so expensive regions do not hold up the
+// rest of the frame.
+class TileScheduler {
+public:
+    TileScheduler(int width, int height, int tile_size, TileOrder order = TileOrder::Hilbert);
+
+    const std::vector<Tile> &getTiles() const {
+        return _tiles;
+    }
+
+    // Calls func once for every tile, in parallel.
+    void run(const std::function<void(const Tile &tile)> &func) const;
+
+    // Calls func once for each tile listed, by index into getTiles(), in
+    // parallel, so tiles that need no more work can be left out.
+    void run(const std::vector<int> &indices, const std::function<void(int index, const Tile &tile)> &func) const;
+
+private:
+    std::vector<Tile> _tiles;
+};
+
+#endif // METROCASTER_TILES_H
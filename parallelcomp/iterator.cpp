@@ -3,37 +3,39 @@
 //
 
 #include <iterator.h>
+#include <thread_pool.h>
 
-#include <algorithm>
+#include <atomic>
 #include <functional>
-#include <thread>
-#include <vector>
 
 void parallel_for(unsigned n_elements, const std::function<void(int start, int end)>& func, bool parallelize) {
-    // Find the number of threads and allocate batch sizes.
-    unsigned n_threads_hint = std::thread::hardware_concurrency();
-    unsigned n_threads = n_threads_hint == 0 ? 8 : (n_threads_hint);
+    // Allocate one batch per thread of the shared pool.
+    ThreadPool &pool = ThreadPool::instance();
+    unsigned n_threads = pool.concurrency();
     unsigned batch_size = n_elements / n_threads;
     unsigned batch_remainder = n_elements % n_threads;
 
-    // Create threads for each batch of work.
-    std::vector<std::thread> threads(n_threads);
-    if (parallelize) {
+    // Queue a task for each batch of work. Nested calls from inside a task
+    // end up on the same pool rather than spawning threads of their own.
+    std::atomic<unsigned> pending(0);
+    if (parallelize && batch_size > 0) {
+        pending = n_threads;
         for (unsigned i = 0; i < n_threads; ++i) {
             int start = i * batch_size;
-            threads[i] = std::thread(func, start, start+batch_size);
+            pool.submit([&func, &pending, start, batch_size] {
+                func(start, start+batch_size);
+                pending.fetch_sub(1, std::memory_order_release);
+            });
         }
-    } else {
+    } else if (batch_size > 0) {
         for (unsigned i = 0; i < n_threads; ++i) {
             int start = i * batch_size;
             func(start, start+batch_size);
         }
     }
 
-    // Deform elements and launch threads, waiting for them to finish.
+    // Deform elements on this thread, then help out until the batches finish.
     int start = n_threads * batch_size;
     func(start, start+batch_remainder);
-    if (parallelize) {
-        std::for_each(threads.begin(), threads.end(), std::mem_fn(&std::thread::join));
-    }
+    pool.wait(pending);
 }
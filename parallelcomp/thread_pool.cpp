@@ -0,0 +1,118 @@
+#include <thread_pool.h>
+
+#include <utility>
+
+namespace {
+    // The pool and worker slot owned by the current thread, if any.
+    thread_local ThreadPool *t_pool = nullptr;
+    thread_local unsigned t_index = 0;
+}
+
+ThreadPool::ThreadPool(unsigned n_workers) :
+        _queued(0),
+        _stop(false) {
+    for (unsigned i = 0; i <= n_workers; ++i) {
+        _queues.emplace_back(new WorkQueue);
+    }
+    for (unsigned i = 0; i < n_workers; ++i) {
+        _workers.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(_sleep_mutex);
+        _stop = true;
+    }
+    _wake.notify_all();
+    for (auto &worker : _workers) {
+        worker.join();
+    }
+}
+
+ThreadPool &ThreadPool::instance() {
+    // The caller of parallel_for also executes tasks, so leave it a core.
+    static ThreadPool pool([] {
+        unsigned n_threads_hint = std::thread::hardware_concurrency();
+        unsigned n_threads = n_threads_hint == 0 ? 8 : n_threads_hint;
+        return n_threads - 1;
+    }());
+    return pool;
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    unsigned index = t_pool == this ? t_index : (unsigned) _workers.size();
+    {
+        std::lock_guard<std::mutex> lock(_queues[index]->mutex);
+        _queues[index]->tasks.push_back(std::move(task));
+    }
+    {
+        // Increment under the sleep mutex so a worker about to sleep sees it.
+        std::lock_guard<std::mutex> lock(_sleep_mutex);
+        ++_queued;
+    }
+    _wake.notify_one();
+}
+
+void ThreadPool::wait(const std::atomic<unsigned> &pending) {
+    while (pending.load(std::memory_order_acquire) > 0) {
+        if (!runPendingTask()) {
+            // Remaining tasks are running on other threads.
+            std::this_thread::yield();
+        }
+    }
+}
+
+void ThreadPool::workerLoop(unsigned index) {
+    t_pool = this;
+    t_index = index;
+
+    while (true) {
+        if (runPendingTask()) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(_sleep_mutex);
+        _wake.wait(lock, [this] { return _stop || _queued.load() > 0; });
+        if (_stop) {
+            return;
+        }
+    }
+}
+
+bool ThreadPool::runPendingTask() {
+    unsigned index = t_pool == this ? t_index : (unsigned) _workers.size();
+
+    std::function<void()> task;
+    if (!popLocal(index, task) && !steal(index, task)) {
+        return false;
+    }
+    --_queued;
+    task();
+    return true;
+}
+
+bool ThreadPool::popLocal(unsigned index, std::function<void()> &task) {
+    WorkQueue &queue = *_queues[index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) {
+        return false;
+    }
+    task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    return true;
+}
+
+bool ThreadPool::steal(unsigned thief, std::function<void()> &task) {
+    // Start at the neighbour so thieves spread out over the victims.
+    unsigned n_queues = (unsigned) _queues.size();
+    for (unsigned offset = 1; offset < n_queues; ++offset) {
+        WorkQueue &queue = *_queues[(thief + offset) % n_queues];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
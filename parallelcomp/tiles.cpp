@@ -0,0 +1,149 @@
+#include <tiles.h>
+#include <thread_pool.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <utility>
+
+namespace {
+    // Spreads the low 16 bits of x out to the even bits.
+    uint32_t spreadBits(uint32_t x) {
+        x &= 0x0000ffff;
+        x = (x | (x << 8)) & 0x00ff00ff;
+        x = (x | (x << 4)) & 0x0f0f0f0f;
+        x = (x | (x << 2)) & 0x33333333;
+        x = (x | (x << 1)) & 0x55555555;
+        return x;
+    }
+
+    uint32_t mortonIndex(uint32_t x, uint32_t y) {
+        return spreadBits(x) | (spreadBits(y) << 1);
+    }
+
+    // Distance along the Hilbert curve filling an n x n grid, n a power of two.
+    uint64_t hilbertIndex(uint32_t n, uint32_t x, uint32_t y) {
+        uint64_t d = 0;
+        for (uint32_t s = n / 2; s > 0; s /= 2) {
+            uint32_t rx = (x & s) > 0;
+            uint32_t ry = (y & s) > 0;
+            d += (uint64_t) s * s * ((3 * rx) ^ ry);
+
+            // Rotate the quadrant so the sub-curve lines up.
+            if (ry == 0) {
+                if (rx == 1) {
+                    x = s - 1 - x;
+                    y = s - 1 - y;
+                }
+                std::swap(x, y);
+            }
+        }
+        return d;
+    }
+}
+
+bool tileOrderFromName(const std::string &name, TileOrder &order) {
+    if (name == "scanline") {
+        order = TileOrder::Scanline;
+    } else if (name == "morton") {
+        order = TileOrder::Morton;
+    } else if (name == "hilbert") {
+        order = TileOrder::Hilbert;
+    } else if (name == "center") {
+        order = TileOrder::CenterOut;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+TileScheduler::TileScheduler(int width, int height, int tile_size, TileOrder order) {
+    tile_size = std::max(tile_size, 1);
+    int n_x = (width + tile_size - 1) / tile_size;
+    int n_y = (height + tile_size - 1) / tile_size;
+
+    // Curve side length covering the whole tile grid.
+    uint32_t n = 1;
+    while (n < (uint32_t) std::max(n_x, n_y)) {
+        n *= 2;
+    }
+
+    // Key every tile by its position along the hand-out order.
+    std::vector<std::pair<uint64_t, Tile>> keyed;
+    keyed.reserve(n_x * n_y);
+    for (int ty = 0; ty < n_y; ++ty) {
+        for (int tx = 0; tx < n_x; ++tx) {
+            Tile tile;
+            tile.x0 = tx * tile_size;
+            tile.y0 = ty * tile_size;
+            tile.x1 = std::min(tile.x0 + tile_size, width);
+            tile.y1 = std::min(tile.y0 + tile_size, height);
+
+            uint64_t key = 0;
+            switch (order) {
+                case TileOrder::Scanline:
+                    key = (uint64_t) ty * n_x + tx;
+                    break;
+                case TileOrder::Morton:
+                    key = mortonIndex(tx, ty);
+                    break;
+                case TileOrder::Hilbert:
+                    key = hilbertIndex(n, tx, ty);
+                    break;
+                case TileOrder::CenterOut: {
+                    // Squared distance in doubled tile units keeps it integral.
+                    int64_t dx = 2 * tx + 1 - n_x;
+                    int64_t dy = 2 * ty + 1 - n_y;
+                    key = dx * dx + dy * dy;
+                }
+                    break;
+            }
+            keyed.emplace_back(key, tile);
+        }
+    }
+
+    std::stable_sort(keyed.begin(), keyed.end(),
+                     [](const std::pair<uint64_t, Tile> &a, const std::pair<uint64_t, Tile> &b) {
+                         return a.first < b.first;
+                     });
+    for (const auto &entry : keyed) {
+        _tiles.push_back(entry.second);
+    }
+}
+
+void TileScheduler::run(const std::function<void(const Tile &tile)> &func) const {
+    std::vector<int> indices(_tiles.size());
+    for (size_t i = 0; i < _tiles.size(); ++i) {
+        indices[i] = (int) i;
+    }
+    run(indices, [&](int, const Tile &tile) {
+        func(tile);
+    });
+}
+
+void TileScheduler::run(const std::vector<int> &indices,
+                        const std::function<void(int index, const Tile &tile)> &func) const {
+    ThreadPool &pool = ThreadPool::instance();
+
+    // Every task keeps claiming the next unclaimed tile until none are left.
+    std::atomic<unsigned> next(0);
+    auto drain = [&] {
+        for (unsigned i = next++; i < indices.size(); i = next++) {
+            func(indices[i], _tiles[indices[i]]);
+        }
+    };
+
+    unsigned n_tasks = std::min(pool.concurrency(), (unsigned) indices.size());
+    std::atomic<unsigned> pending(0);
+    if (n_tasks > 1) {
+        pending = n_tasks - 1;
+        for (unsigned i = 1; i < n_tasks; ++i) {
+            pool.submit([&] {
+                drain();
+                pending.fetch_sub(1, std::memory_order_release);
+            });
+        }
+    }
+    drain();
+    pool.wait(pending);
+}
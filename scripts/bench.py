@@ -0,0 +1,49 @@
+import os
+import re
+import subprocess
+import sys
+import time
+
+
+# Mesh-heavy scenes, where mesh traversal dominates the render time.
+SCENES = [
+    'data/scene05_bunny_200.txt',
+    'data/scene06_bunny_1k.txt',
+    'data/scene07_arch.txt',
+]
+
+
+def bench(binary, scene, size, iters, runs):
+    best = None
+    accel = []
+    # Meshes print their acceleration structure statistics only when asked.
+    env = dict(os.environ, METROCASTER_MESH_STATS='1')
+    for _ in range(runs):
+        start = time.time()
+        out = subprocess.run([binary, '-input', scene, '-size', str(size), str(size),
+                              '-iters', str(iters), '-length', '3'],
+                             stdout=subprocess.PIPE, universal_newlines=True, check=True, env=env).stdout
+        elapsed = time.time() - start
+        best = elapsed if best is None else min(best, elapsed)
+        accel = re.findall(r'^(?:Octree|BVH4)\b.*$', out, re.MULTILINE)
+    return best, accel
+
+
+if __name__ == '__main__':
+    print(sys.argv)
+
+    if len(sys.argv) < 2:
+        print("Please pass in the metrocaster binary [size] [iters] [runs]")
+    else:
+        binary = sys.argv[1]
+        size = int(sys.argv[2]) if len(sys.argv) > 2 else 64
+        iters = int(sys.argv[3]) if len(sys.argv) > 3 else 4
+        runs = int(sys.argv[4]) if len(sys.argv) > 4 else 3
+
+        for scene in SCENES:
+            best, accel = bench(binary, scene, size, iters, runs)
+            rays = size * size * iters
+            print(scene)
+            for line in accel:
+                print('  ' + line)
+            print('  best of %d: %.3f s, %.2f us per camera sample' % (runs, best, 1e6 * best / rays))
@@ -1,5 +1,9 @@
 #include "ArgParser.h"
 
+#include "RenderMode.h"
+#include "SampleGenerator.h"
+#include "tiles.h"
+
 #include <cstring>
 #include <cassert>
 #include <cstdio>
@@ -37,6 +41,118 @@ ArgParser::ArgParser(int argc, const char *argv[]) {
             i++;
             assert (i < argc);
             length = atof(argv[i]);
+        } else if (!strcmp(argv[i], "-seed")) {
+            i++;
+            assert (i < argc);
+            seed = atoi(argv[i]);
+        } else if (!strcmp(argv[i], "-sampler")) {
+            i++;
+            assert (i < argc);
+            sampler = argv[i];
+            SamplePattern pattern;
+            if (!samplePatternFromName(sampler, pattern)) {
+                printf("Unknown sampler '%s'\n", argv[i]);
+                exit(1);
+            }
+        } else if (!strcmp(argv[i], "-mode")) {
+            i++;
+            assert (i < argc);
+            mode = argv[i];
+            RenderMode renderMode;
+            if (!renderModeFromName(mode, renderMode)) {
+                printf("Unknown mode '%s'\n", argv[i]);
+                exit(1);
+            }
+        }
+
+        else if (!strcmp(argv[i], "-camera")) {
+            camera.clear();
+            for (int k = 0; k < 10; k++) {
+                i++;
+                assert (i < argc);
+                camera.push_back(atof(argv[i]));
+            }
+        }
+
+        // metropolis
+        else if (!strcmp(argv[i], "-chains")) {
+            i++;
+            assert (i < argc);
+            chains = atoi(argv[i]);
+        } else if (!strcmp(argv[i], "-bootstrap")) {
+            i++;
+            assert (i < argc);
+            bootstrap = atoi(argv[i]);
+        } else if (!strcmp(argv[i], "-temperatures")) {
+            i++;
+            assert (i < argc);
+            temperatures = atoi(argv[i]);
+        }
+
+        // progressive rendering
+        else if (!strcmp(argv[i], "-pass")) {
+            i++;
+            assert (i < argc);
+            pass = atoi(argv[i]);
+        } else if (!strcmp(argv[i], "-snapshot")) {
+            i++;
+            assert (i < argc);
+            snapshot = atof(argv[i]);
+        } else if (!strcmp(argv[i], "-snapshot-passes")) {
+            i++;
+            assert (i < argc);
+            snapshot_passes = atoi(argv[i]);
+        } else if (!strcmp(argv[i], "-time")) {
+            i++;
+            assert (i < argc);
+            time = atof(argv[i]);
+        } else if (!strcmp(argv[i], "-target-rel-error")) {
+            i++;
+            assert (i < argc);
+            target_rel_error = atof(argv[i]);
+        } else if (!strcmp(argv[i], "-adaptive")) {
+            i++;
+            assert (i < argc);
+            adaptive = atof(argv[i]);
+        }
+
+        // checkpoints
+        else if (!strcmp(argv[i], "-checkpoint")) {
+            i++;
+            assert (i < argc);
+            checkpoint_file = argv[i];
+        } else if (!strcmp(argv[i], "-resume")) {
+            i++;
+            assert (i < argc);
+            resume_file = argv[i];
+        } else if (!strcmp(argv[i], "-merge")) {
+            i++;
+            assert (i < argc);
+            merge_files.push_back(argv[i]);
+        } else if (!strcmp(argv[i], "-shard")) {
+            i++;
+            assert (i < argc);
+            if (sscanf(argv[i], "%d/%d", &shard_index, &shard_count) != 2 || shard_count < 1 ||
+                shard_index < 0 || shard_index >= shard_count) {
+                printf("Bad shard '%s', expected k/N with 0 <= k < N\n", argv[i]);
+                exit(1);
+            }
+        }
+
+        // tiling
+        else if (!strcmp(argv[i], "-tile")) {
+            i++;
+            assert (i < argc);
+            tile_size = atoi(argv[i]);
+        } else if (!strcmp(argv[i], "-tile-order")) {
+            i++;
+            assert (i < argc);
+            tile_order = argv[i];
+            TileOrder order;
+            if (!tileOrderFromName(tile_order, order)) {
+                printf("Unknown tile order '%s'\n", argv[i]);
+                exit(1);
+            }
         }
 
         // logging
@@ -46,6 +162,13 @@ ArgParser::ArgParser(int argc, const char *argv[]) {
             log_file = argv[i];
         }
 
+        // render daemon
+        else if (!strcmp(argv[i], "-serve") || !strcmp(argv[i], "--serve")) {
+            i++;
+            assert (i < argc);
+            serve_socket = argv[i];
+        }
+
         // Unknown argument.
         else {
             printf("Unknown command line argument %d: '%s'\n", i, argv[i]);
@@ -60,7 +183,35 @@ ArgParser::ArgParser(int argc, const char *argv[]) {
     std::cout << "- height: " << height << std::endl;
     std::cout << "- iters: " << iters << std::endl;
     std::cout << "- length: " << length << std::endl;
+    std::cout << "- seed: " << seed << std::endl;
+    std::cout << "- sampler: " << sampler << std::endl;
+    std::cout << "- mode: " << mode << std::endl;
+    if (!camera.empty()) {
+        std::cout << "- camera:";
+        for (float c : camera) {
+            std::cout << " " << c;
+        }
+        std::cout << std::endl;
+    }
+    std::cout << "- chains: " << chains << std::endl;
+    std::cout << "- bootstrap: " << bootstrap << std::endl;
+    std::cout << "- temperatures: " << temperatures << std::endl;
+    std::cout << "- pass: " << pass << std::endl;
+    std::cout << "- snapshot: " << snapshot << "s, " << snapshot_passes << " passes" << std::endl;
+    std::cout << "- time: " << time << std::endl;
+    std::cout << "- target-rel-error: " << target_rel_error << std::endl;
+    std::cout << "- adaptive: " << adaptive << std::endl;
+    std::cout << "- checkpoint: " << checkpoint_file << std::endl;
+    std::cout << "- resume: " << resume_file << std::endl;
+    for (const std::string &file : merge_files) {
+        std::cout << "- merge: " << file << std::endl;
+    }
+    std::cout << "- shard: " << shard_index << "/" << shard_count << std::endl;
+    std::cout << "- tile: " << tile_size << " (" << tile_order << ")" << std::endl;
     std::cout << "- log: " << log_file << std::endl;
+    if (!serve_socket.empty()) {
+        std::cout << "- serve: " << serve_socket << std::endl;
+    }
 }
 
 void
@@ -74,7 +225,44 @@ ArgParser::defaultValues() {
     // rendering options
     iters = 10;
     length = 1.f;
+    seed = 0;
+    sampler = "sobol";
+    mode = "bdpt";
+    camera.clear();
+
+    // metropolis, where 0 picks a default from the image and thread count
+    chains = 0;
+    bootstrap = 0;
+    temperatures = 1;
+
+    // progressive rendering: 0 renders every sample in one pass, and a
+    // snapshot is written when either of its limits is reached, 0 for none
+    pass = 0;
+    snapshot = 0;
+    snapshot_passes = 1;
+
+    // stopping criteria, 0 for none; either one replaces the iters limit
+    time = 0;
+    target_rel_error = 0;
+
+    // relative error at which adaptive sampling retires a tile, 0 for
+    // uniform sampling
+    adaptive = 0;
+
+    // checkpoints
+    checkpoint_file = "";
+    resume_file = "";
+    merge_files.clear();
+    shard_index = 0;
+    shard_count = 1;
+
+    // tiling
+    tile_size = 16;
+    tile_order = "hilbert";
 
     // logging
     log_file = "";
+
+    // render daemon
+    serve_socket = "";
 }
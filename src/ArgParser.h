@@ -2,6 +2,7 @@
 #define ARG_PARSER_H
 
 #include <string>
+#include <vector>
 
 class ArgParser {
 public:
@@ -20,10 +21,43 @@ public:
     // rendering options
     int iters;
     float length;
+    int seed;
+    std::string sampler;
+    std::string mode;
+    // Center, direction, up and angle in degrees of a camera that replaces
+    // the scene's, or empty.
+    std::vector<float> camera;
+
+    // metropolis
+    int chains;
+    int bootstrap;
+    int temperatures;
+
+    // progressive rendering
+    int pass;
+    float snapshot;
+    int snapshot_passes;
+    float time;
+    float target_rel_error;
+    float adaptive;
+
+    // checkpoints
+    std::string checkpoint_file;
+    std::string resume_file;
+    std::vector<std::string> merge_files;
+    int shard_index;
+    int shard_count;
+
+    // tiling
+    int tile_size;
+    std::string tile_order;
 
     // logging
     std::string log_file;
 
+    // render daemon
+    std::string serve_socket;
+
 private:
     void defaultValues();
 };
@@ -0,0 +1,283 @@
+#include "BVH.h"
+
+#include "Object3D.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+
+std::unique_ptr<BVHBuilder::BuildNode>
+BVHBuilder::build(std::vector<Primitive> &prims) const {
+    if (prims.empty()) {
+        return nullptr;
+    }
+    return buildRecursive(prims, 0, (int) prims.size(), 0);
+}
+
+std::unique_ptr<BVHBuilder::BuildNode>
+BVHBuilder::buildRecursive(std::vector<Primitive> &prims, int begin, int end, int depth) const {
+    std::unique_ptr<BuildNode> node(new BuildNode);
+    node->axis = 0;
+    node->first = begin;
+    node->count = end - begin;
+
+    Box centroids;
+    for (int ii = begin; ii < end; ii++) {
+        node->box.extend(prims[ii].box);
+        centroids.extend(prims[ii].centroid);
+    }
+
+    int count = end - begin;
+    if (count <= 1) {
+        return node;
+    }
+
+    // Bin along the axis with the widest centroid spread.
+    Vector3f extent = centroids.mx - centroids.mn;
+    int axis = 0;
+    if (extent[1] > extent[axis]) {
+        axis = 1;
+    }
+    if (extent[2] > extent[axis]) {
+        axis = 2;
+    }
+    int split = begin + count / 2;
+    if (extent[axis] <= 0) {
+        // All centroids coincide, so any split is as good as the next.
+        if (count <= _max_leaf) {
+            return node;
+        }
+        return buildChildren(std::move(node), prims, begin, split, end, depth);
+    }
+    if (depth >= max_sah_depth) {
+        std::nth_element(&prims[begin], &prims[split], &prims[begin] + count,
+                         [axis](const Primitive &a, const Primitive &b) {
+                             return a.centroid[axis] < b.centroid[axis];
+                         });
+        node->axis = axis;
+        return buildChildren(std::move(node), prims, begin, split, end, depth);
+    }
+
+    Box binBox[n_bins];
+    int binCount[n_bins] = {0};
+    float scale = n_bins / extent[axis];
+    auto binOf = [&](const Primitive &p) {
+        int b = (int) ((p.centroid[axis] - centroids.mn[axis]) * scale);
+        return b < n_bins ? b : n_bins - 1;
+    };
+    for (int ii = begin; ii < end; ii++) {
+        int b = binOf(prims[ii]);
+        binCount[b]++;
+        binBox[b].extend(prims[ii].box);
+    }
+
+    // Sweep from both sides to get the SAH cost of every split plane.
+    float rightArea[n_bins];
+    int rightCount[n_bins];
+    Box acc;
+    int n = 0;
+    for (int b = n_bins - 1; b > 0; b--) {
+        acc.extend(binBox[b]);
+        n += binCount[b];
+        rightArea[b] = acc.surfaceArea();
+        rightCount[b] = n;
+    }
+
+    float bestCost = std::numeric_limits<float>::max();
+    int bestSplit = -1;
+    acc = Box();
+    n = 0;
+    for (int b = 1; b < n_bins; b++) {
+        acc.extend(binBox[b - 1]);
+        n += binCount[b - 1];
+        if (n == 0 || rightCount[b] == 0) {
+            continue;
+        }
+        float cost = primitiveCost(n) * acc.surfaceArea() + primitiveCost(rightCount[b]) * rightArea[b];
+        if (cost < bestCost) {
+            bestCost = cost;
+            bestSplit = b;
+        }
+    }
+
+    // Traversal costs about as much as one primitive test.
+    float leafCost = primitiveCost(count);
+    float area = node->box.surfaceArea();
+    float splitCost = area > 0 ? 1 + bestCost / area : 1;
+    if (bestSplit < 0 || (count <= _max_leaf && leafCost <= splitCost)) {
+        return node;
+    }
+
+    Primitive *mid = std::partition(&prims[begin], &prims[begin] + count,
+                                    [&](const Primitive &p) { return binOf(p) < bestSplit; });
+    split = (int) (mid - &prims[0]);
+
+    node->axis = axis;
+    return buildChildren(std::move(node), prims, begin, split, end, depth);
+}
+
+std::unique_ptr<BVHBuilder::BuildNode>
+BVHBuilder::buildChildren(std::unique_ptr<BuildNode> node, std::vector<Primitive> &prims,
+                          int begin, int split, int end, int depth) const {
+    node->count = 0;
+    if (end - begin > parallel_threshold) {
+        // The halves cover disjoint ranges of prims, so they can be built
+        // concurrently.
+        ThreadPool &pool = ThreadPool::instance();
+        std::atomic<unsigned> pending(1);
+        BuildNode *parent = node.get();
+        pool.submit([&] {
+            parent->child[0] = buildRecursive(prims, begin, split, depth + 1);
+            pending.fetch_sub(1, std::memory_order_release);
+        });
+        node->child[1] = buildRecursive(prims, split, end, depth + 1);
+        pool.wait(pending);
+    } else {
+        node->child[0] = buildRecursive(prims, begin, split, depth + 1);
+        node->child[1] = buildRecursive(prims, split, end, depth + 1);
+    }
+    return node;
+}
+
+void
+BVH::build(const std::vector<Object3D *> &objects) {
+    _nodes.clear();
+    _objects.clear();
+    _unbounded.clear();
+
+    std::vector<BVHBuilder::Primitive> prims;
+    prims.reserve(objects.size());
+    for (size_t ii = 0; ii < objects.size(); ii++) {
+        BVHBuilder::Primitive p;
+        if (!objects[ii]->getBounds(p.box)) {
+            _unbounded.push_back(objects[ii]);
+            continue;
+        }
+        p.centroid = p.box.center();
+        p.index = (int) ii;
+        prims.push_back(p);
+    }
+
+    std::unique_ptr<BVHBuilder::BuildNode> root = BVHBuilder(max_leaf).build(prims);
+    if (!root) {
+        return;
+    }
+
+    _objects.reserve(prims.size());
+    for (const BVHBuilder::Primitive &p : prims) {
+        _objects.push_back(objects[p.index]);
+    }
+    flatten(root.get());
+}
+
+int
+BVH::flatten(const BVHBuilder::BuildNode *node) {
+    int index = (int) _nodes.size();
+    _nodes.emplace_back();
+    _nodes[index].box = node->box;
+    _nodes[index].axis = (uint8_t) node->axis;
+    if (node->count > 0) {
+        _nodes[index].offset = node->first;
+        _nodes[index].count = (uint16_t) node->count;
+    } else {
+        flatten(node->child[0].get());
+        int second = flatten(node->child[1].get());
+        _nodes[index].offset = second;
+        _nodes[index].count = 0;
+    }
+    return index;
+}
+
+bool
+BVH::intersect(const Ray &r, float tmin, Hit &h) const {
+    bool result = false;
+    for (Object3D *o : _unbounded) {
+        if (o->intersect(r, tmin, h)) {
+            result = true;
+        }
+    }
+    if (_nodes.empty()) {
+        return result;
+    }
+
+    const Vector3f origin = r.getOrigin();
+    const Vector3f dir = r.getDirection();
+    Vector3f invDir(1 / dir[0], 1 / dir[1], 1 / dir[2]);
+    bool negative[3] = {invDir[0] < 0, invDir[1] < 0, invDir[2] < 0};
+
+    int stack[64];
+    int top = 0;
+    int current = 0;
+    while (true) {
+        const Node &node = _nodes[current];
+        float t0 = tmin;
+        float t1 = h.getT();
+        if (node.box.intersect(origin, invDir, t0, t1)) {
+            if (node.count > 0) {
+                for (int ii = node.offset; ii < node.offset + node.count; ii++) {
+                    if (_objects[ii]->intersect(r, tmin, h)) {
+                        result = true;
+                    }
+                }
+            } else if (negative[node.axis]) {
+                // Visit the nearer child first so hits shrink the far one.
+                stack[top++] = current + 1;
+                current = node.offset;
+                continue;
+            } else {
+                stack[top++] = node.offset;
+                current = current + 1;
+                continue;
+            }
+        }
+        if (top == 0) {
+            break;
+        }
+        current = stack[--top];
+    }
+    return result;
+}
+
+bool
+BVH::occluded(const Ray &r, float tmin, float tmax) const {
+    for (Object3D *o : _unbounded) {
+        if (o->occluded(r, tmin, tmax)) {
+            return true;
+        }
+    }
+    if (_nodes.empty()) {
+        return false;
+    }
+
+    const Vector3f origin = r.getOrigin();
+    const Vector3f dir = r.getDirection();
+    Vector3f invDir(1 / dir[0], 1 / dir[1], 1 / dir[2]);
+
+    int stack[64];
+    int top = 0;
+    int current = 0;
+    while (true) {
+        const Node &node = _nodes[current];
+        float t0 = tmin;
+        float t1 = tmax;
+        if (node.box.intersect(origin, invDir, t0, t1)) {
+            if (node.count > 0) {
+                for (int ii = node.offset; ii < node.offset + node.count; ii++) {
+                    if (_objects[ii]->occluded(r, tmin, tmax)) {
+                        return true;
+                    }
+                }
+            } else {
+                stack[top++] = node.offset;
+                current = current + 1;
+                continue;
+            }
+        }
+        if (top == 0) {
+            break;
+        }
+        current = stack[--top];
+    }
+    return false;
+}
@@ -0,0 +1,113 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "AlignedAllocator.h"
+#include "Box.h"
+#include "Ray.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class Object3D;
+
+// Binary BVH builder using the surface area heuristic. Splits are chosen by
+// binning primitive centroids along the widest axis; large subtrees are
+// built in parallel on the thread pool. Shared by the scene BVH and the
+// wide mesh BVH, which flatten the resulting tree in their own layouts.
+class BVHBuilder {
+public:
+    struct Primitive {
+        Box box;
+        Vector3f centroid;
+        int index;
+    };
+
+    // Leaves cover prims[first, first + count); interior nodes have count 0.
+    struct BuildNode {
+        Box box;
+        std::unique_ptr<BuildNode> child[2];
+        int axis;
+        int first;
+        int count;
+    };
+
+    // Leaves of up to max_leaf primitives are made wherever SAH prefers them.
+    // Leaves are costed in groups of packet_size primitives, for traversals
+    // that test that many at once.
+    explicit BVHBuilder(int max_leaf, int packet_size = 1) :
+            _max_leaf(max_leaf),
+            _packet_size(packet_size) {}
+
+    // Reorders prims so that every leaf covers a contiguous range.
+    std::unique_ptr<BuildNode> build(std::vector<Primitive> &prims) const;
+
+private:
+    std::unique_ptr<BuildNode> buildRecursive(std::vector<Primitive> &prims, int begin, int end, int depth) const;
+
+    std::unique_ptr<BuildNode> buildChildren(std::unique_ptr<BuildNode> node, std::vector<Primitive> &prims,
+                                             int begin, int split, int end, int depth) const;
+
+    // Subtrees with more primitives than this are split across threads.
+    static const int parallel_threshold = 4096;
+    // Past this depth splits fall back to the object median, which bounds
+    // the tree depth by the size of the traversal stacks.
+    static const int max_sah_depth = 32;
+    static const int n_bins = 16;
+
+    // Cost of intersecting n primitives, in units of one box test.
+    float primitiveCost(int n) const {
+        return (float) ((n + _packet_size - 1) / _packet_size);
+    }
+
+    int _max_leaf;
+    int _packet_size;
+};
+
+// Bounding volume hierarchy over bounded scene objects. The tree is
+// flattened depth-first into one array.
+class BVH {
+public:
+    BVH() {}
+
+    // Objects without finite bounds, such as planes, are kept out of the
+    // tree and tested by every query.
+    void build(const std::vector<Object3D *> &objects);
+
+    bool intersect(const Ray &r, float tmin, Hit &h) const;
+
+    // Any object with tmin < t < tmax. Children are visited in stack order,
+    // since the first hit found ends the search.
+    bool occluded(const Ray &r, float tmin, float tmax) const;
+
+    bool empty() const {
+        return _nodes.empty() && _unbounded.empty();
+    }
+
+    bool hasUnbounded() const {
+        return !_unbounded.empty();
+    }
+
+private:
+    // 32-byte node, two to a cache line. Interior nodes keep their first
+    // child right after themselves and store the index of the second; leaves
+    // store a range into _objects.
+    struct Node {
+        Box box;
+        int32_t offset;
+        uint16_t count;
+        uint8_t axis;
+    };
+
+    static_assert(sizeof(Node) == 32, "BVH nodes should pack two to a cache line");
+
+    int flatten(const BVHBuilder::BuildNode *node);
+
+    static const int max_leaf = 4;
+
+    std::vector<Node, AlignedAllocator<Node>> _nodes;
+    std::vector<Object3D *> _objects;
+    std::vector<Object3D *> _unbounded;
+};
+
+#endif // BVH_H
@@ -0,0 +1,74 @@
+#ifndef BOX_H
+#define BOX_H
+
+#include "Vector3f.h"
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+// Axis-aligned bounding box.
+struct Box {
+    Vector3f mn, mx;
+
+    // An empty box: extending it by anything yields that thing.
+    Box() :
+            mn(std::numeric_limits<float>::max()),
+            mx(-std::numeric_limits<float>::max()) {}
+
+    Box(const Vector3f &a, const Vector3f &b) :
+            mn(a),
+            mx(b) {}
+
+    Box(float mnx, float mny, float mnz,
+        float mxx, float mxy, float mxz) :
+            mn(Vector3f(mnx, mny, mnz)),
+            mx(Vector3f(mxx, mxy, mxz)) {}
+
+    void extend(const Vector3f &p) {
+        for (int dim = 0; dim < 3; dim++) {
+            mn[dim] = std::min(mn[dim], p[dim]);
+            mx[dim] = std::max(mx[dim], p[dim]);
+        }
+    }
+
+    void extend(const Box &b) {
+        for (int dim = 0; dim < 3; dim++) {
+            mn[dim] = std::min(mn[dim], b.mn[dim]);
+            mx[dim] = std::max(mx[dim], b.mx[dim]);
+        }
+    }
+
+    Vector3f center() const {
+        return 0.5f * (mn + mx);
+    }
+
+    float surfaceArea() const {
+        Vector3f d = mx - mn;
+        if (d[0] < 0 || d[1] < 0 || d[2] < 0) {
+            return 0;
+        }
+        return 2 * (d[0] * d[1] + d[1] * d[2] + d[2] * d[0]);
+    }
+
+    // Slab test. Narrows [tmin, tmax] to the overlap with the box and returns
+    // whether it is non-empty. NaNs from zero direction components leave the
+    // interval untouched.
+    bool intersect(const Vector3f &origin, const Vector3f &invDir, float &tmin, float &tmax) const {
+        for (int dim = 0; dim < 3; dim++) {
+            float t0 = (mn[dim] - origin[dim]) * invDir[dim];
+            float t1 = (mx[dim] - origin[dim]) * invDir[dim];
+            if (t0 > t1) {
+                std::swap(t0, t1);
+            }
+            tmin = t0 > tmin ? t0 : tmin;
+            tmax = t1 < tmax ? t1 : tmax;
+            if (tmin > tmax) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+#endif // BOX_H
@@ -14,6 +14,12 @@ public:
     // Generate rays for each screen-space coordinate
     virtual Ray generateRay(const Vector2f &point) = 0;
 
+    // Screen-space coordinate whose ray passes through point. Returns false
+    // if the point is behind the camera.
+    virtual bool project(const Vector3f &point, Vector2f &screen) const = 0;
+
+    virtual Vector3f getCenter() const = 0;
+
     virtual float getTMin() const = 0;
 };
 
@@ -28,6 +34,7 @@ public:
             _up(up),
             _angle(angleradians) {
         _horizontal = Vector3f::cross(direction, up).normalized();
+        _toScreen = Matrix3f(_direction, _horizontal, _up).inverse();
     }
 
     Ray generateRay(const Vector2f &point) override {
@@ -40,6 +47,22 @@ public:
         // END STARTER
     }
 
+    bool project(const Vector3f &point, Vector2f &screen) const override {
+        // Solve point - center = s * (d * direction + x * horizontal + y * up)
+        // for the (x, y) that generateRay takes.
+        float d = 1.0f / (float) std::tan(_angle / 2.0f);
+        Vector3f a = _toScreen * (point - _center);
+        if (a[0] <= 0) {
+            return false;
+        }
+        screen = (d / a[0]) * Vector2f(a[1], a[2]);
+        return true;
+    }
+
+    Vector3f getCenter() const override {
+        return _center;
+    }
+
     float getTMin() const override {
         return 0.0f;
     }
@@ -50,6 +73,8 @@ private:
     Vector3f _up;
     float _angle;
     Vector3f _horizontal;
+    // Maps directions to their direction, horizontal and up components.
+    Matrix3f _toScreen;
 };
 
 #endif //CAMERA_H
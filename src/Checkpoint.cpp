@@ -0,0 +1,180 @@
+#include "Checkpoint.h"
+
+#include "ArgParser.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+// File layout, in the writing machine's byte order: the magic and version,
+// the key, width, height and seed count, the seeds, 7 floats per pixel of
+// film and one sample count per pixel for each seed.
+static const char checkpoint_magic[4] = {'M', 'C', 'C', 'K'};
+static const uint32_t checkpoint_version = 3;
+
+// Floats per pixel in the film: weighted color and weight, then splats.
+static const int film_floats = 7;
+
+// 64-bit FNV-1a.
+static uint64_t
+hashBytes(uint64_t h, const void *data, size_t size) {
+    const unsigned char *bytes = (const unsigned char *) data;
+    for (size_t i = 0; i < size; i++) {
+        h ^= bytes[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+bool
+checkpointKey(const ArgParser &args, const std::vector<std::string> &sourceFiles, uint64_t &key,
+              std::string &error) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (const std::string &filename : sourceFiles) {
+        FILE *file = fopen(filename.c_str(), "rb");
+        if (!file) {
+            error = "Cannot read '" + filename + "' to key the checkpoint";
+            return false;
+        }
+        char buffer[1 << 16];
+        size_t n;
+        uint64_t size = 0;
+        while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+            h = hashBytes(h, buffer, n);
+            size += n;
+        }
+        bool ok = !ferror(file);
+        fclose(file);
+        if (!ok) {
+            error = "Cannot read '" + filename + "' to key the checkpoint";
+            return false;
+        }
+        // Sizes keep the boundaries between files in the hash.
+        h = hashBytes(h, &size, sizeof(size));
+    }
+
+    char options[256];
+    snprintf(options, sizeof(options), "%d %d %g %s %s %d %d %d", args.width, args.height, args.length,
+             args.sampler.c_str(), args.mode.c_str(), args.chains, args.bootstrap, args.temperatures);
+    h = hashBytes(h, options, strlen(options));
+    // A camera override changes the view.
+    uint64_t n_camera = args.camera.size();
+    h = hashBytes(h, &n_camera, sizeof(n_camera));
+    key = hashBytes(h, args.camera.data(), sizeof(float) * args.camera.size());
+    return true;
+}
+
+void
+Checkpoint::reset(uint64_t k, int w, int h, int32_t seed) {
+    key = k;
+    width = w;
+    height = h;
+    seeds.assign(1, seed);
+    film.assign(film_floats * (size_t) w * h, 0.f);
+    samples.assign((size_t) w * h, 0);
+}
+
+bool
+Checkpoint::merge(const Checkpoint &other, std::string &error) {
+    if (other.key != key || other.width != width || other.height != height) {
+        error = "Checkpoints are of different scenes or options";
+        return false;
+    }
+
+    // The same sample twice would count twice.
+    size_t pixels = (size_t) width * height;
+    std::vector<int32_t> merged(samples);
+    for (size_t j = 0; j < other.seeds.size(); j++) {
+        const int32_t *theirs = &other.samples[j * pixels];
+        size_t k = 0;
+        while (k < seeds.size() && seeds[k] != other.seeds[j]) {
+            k++;
+        }
+        if (k == seeds.size()) {
+            merged.insert(merged.end(), theirs, theirs + pixels);
+            continue;
+        }
+        int32_t *ours = &merged[k * pixels];
+        for (size_t i = 0; i < pixels; i++) {
+            if (ours[i] > 0 && theirs[i] > 0) {
+                error = "Checkpoints repeat samples of seed " + std::to_string(seeds[k]);
+                return false;
+            }
+            ours[i] += theirs[i];
+        }
+    }
+
+    for (int32_t seed : other.seeds) {
+        if (std::find(seeds.begin(), seeds.end(), seed) == seeds.end()) {
+            seeds.push_back(seed);
+        }
+    }
+    samples.swap(merged);
+    for (size_t i = 0; i < film.size(); i++) {
+        film[i] += other.film[i];
+    }
+    return true;
+}
+
+bool
+Checkpoint::save(const std::string &filename) const {
+    std::string partial = filename + ".part";
+    FILE *file = fopen(partial.c_str(), "wb");
+    if (!file) {
+        printf("Could not write checkpoint '%s'\n", partial.c_str());
+        return false;
+    }
+
+    uint32_t n_seeds = (uint32_t) seeds.size();
+    bool ok = fwrite(checkpoint_magic, sizeof(checkpoint_magic), 1, file) == 1 &&
+              fwrite(&checkpoint_version, sizeof(checkpoint_version), 1, file) == 1 &&
+              fwrite(&key, sizeof(key), 1, file) == 1 &&
+              fwrite(&width, sizeof(width), 1, file) == 1 &&
+              fwrite(&height, sizeof(height), 1, file) == 1 &&
+              fwrite(&n_seeds, sizeof(n_seeds), 1, file) == 1 &&
+              fwrite(seeds.data(), sizeof(int32_t), seeds.size(), file) == seeds.size() &&
+              fwrite(film.data(), sizeof(float), film.size(), file) == film.size() &&
+              fwrite(samples.data(), sizeof(int32_t), samples.size(), file) == samples.size();
+    ok = fclose(file) == 0 && ok;
+    if (!ok || std::rename(partial.c_str(), filename.c_str()) != 0) {
+        printf("Could not write checkpoint '%s'\n", filename.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool
+Checkpoint::load(const std::string &filename, std::string &error) {
+    FILE *file = fopen(filename.c_str(), "rb");
+    if (!file) {
+        error = "Could not open checkpoint '" + filename + "'";
+        return false;
+    }
+
+    char magic[4];
+    uint32_t version = 0;
+    uint32_t n_seeds = 0;
+    bool ok = fread(magic, sizeof(magic), 1, file) == 1 &&
+              memcmp(magic, checkpoint_magic, sizeof(magic)) == 0 &&
+              fread(&version, sizeof(version), 1, file) == 1 &&
+              version == checkpoint_version &&
+              fread(&key, sizeof(key), 1, file) == 1 &&
+              fread(&width, sizeof(width), 1, file) == 1 &&
+              fread(&height, sizeof(height), 1, file) == 1 &&
+              fread(&n_seeds, sizeof(n_seeds), 1, file) == 1 &&
+              width > 0 && height > 0 && n_seeds > 0;
+    if (ok) {
+        size_t pixels = (size_t) width * height;
+        seeds.resize(n_seeds);
+        film.resize(film_floats * pixels);
+        samples.resize(n_seeds * pixels);
+        ok = fread(seeds.data(), sizeof(int32_t), seeds.size(), file) == seeds.size() &&
+             fread(film.data(), sizeof(float), film.size(), file) == film.size() &&
+             fread(samples.data(), sizeof(int32_t), samples.size(), file) == samples.size();
+    }
+    fclose(file);
+    if (!ok) {
+        error = "'" + filename + "' is not a checkpoint";
+    }
+    return ok;
+}
@@ -0,0 +1,64 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class ArgParser;
+
+// Saved state of a progressive render, enough to continue it or to add it
+// to another render of the same image. Samples are a function of the seed,
+// the pixel and the sample index alone, so each pixel's sample count is
+// also the position of its random stream, and a pixel's samples for one
+// seed are always its first ones.
+struct Checkpoint {
+    Checkpoint() :
+            key(0),
+            width(0),
+            height(0) {}
+
+    // Hash of the scene and of the options that shape the image.
+    uint64_t key;
+    int width;
+    int height;
+    // Seeds whose samples are in the film. The first is the one a resumed
+    // render continues with.
+    std::vector<int32_t> seeds;
+    // Film contents, as AccumulationImage::getFloats returns them.
+    std::vector<float> film;
+    // Samples taken in each pixel, row by row, for each seed in turn.
+    std::vector<int32_t> samples;
+
+    // Empty film for the given render and seed.
+    void reset(uint64_t key, int width, int height, int32_t seed);
+
+    // Sample counts of seed k.
+    int32_t *seedSamples(size_t k) {
+        return &samples[k * width * height];
+    }
+
+    // Adds another checkpoint of the same render. Both may hold samples of
+    // a seed as long as no pixel has them in both, as with shards of one
+    // render. Returns false, with the reason in error, if the checkpoints do
+    // not fit.
+    bool merge(const Checkpoint &other, std::string &error);
+
+    // Writes the checkpoint next to the file and renames it into place, so
+    // a render killed while writing keeps the previous checkpoint.
+    bool save(const std::string &filename) const;
+
+    // Returns false, with the reason in error, if the file is missing or is
+    // not a checkpoint.
+    bool load(const std::string &filename, std::string &error);
+};
+
+// Key of the render the arguments describe: a hash of the contents of the
+// files the scene was built from, the image size, the camera override and
+// the path and strategy options. The seed and the sample count are left
+// out, so renders that differ only in those can be merged. Returns false,
+// with the reason in error, if a file cannot be read.
+bool checkpointKey(const ArgParser &args, const std::vector<std::string> &sourceFiles, uint64_t &key,
+                   std::string &error);
+
+#endif // CHECKPOINT_H
@@ -4,14 +4,18 @@
 #include <string>
 
 CubeMap::CubeMap(const std::string &directory) {
-    std::string side[6] = {"left", "right", "up", "down", "front", "back"};
     for (int ii = 0; ii < 6; ii++) {
-        std::string filename = directory + "/" + side[ii] + ".png";
-        _images[ii] = Image::loadPNG(filename);
+        _images[ii] = Image::loadPNG(faceFile(directory, ii));
     }
 
 }
 
+std::string
+CubeMap::faceFile(const std::string &directory, int face) {
+    static const char *side[6] = {"left", "right", "up", "down", "front", "back"};
+    return directory + "/" + side[face] + ".png";
+}
+
 
 Vector3f
 CubeMap::getFaceTexel(float x, float y, int face) const {
@@ -22,6 +22,9 @@ public:
     // Assumes a directory containing {left,right,up,down,front,back}.png
     CubeMap(const std::string &directory);
 
+    // Image file of one face in the directory.
+    static std::string faceFile(const std::string &directory, int face);
+
     // Returns color for given directory
     Vector3f getTexel(const Vector3f &direction) const;
 
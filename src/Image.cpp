@@ -1,5 +1,7 @@
 #include <cstring>
 #include <cassert>
+#include <cmath>
+#include <limits>
 
 #include "Image.h"
 
@@ -22,6 +24,153 @@ clampColorComponent(float c) {
     return uint8_t(tmp);
 }
 
+Image
+AccumulationImage::resolve() const {
+    Image image(_width, _height);
+    double totalWeight = 0;
+    for (int y = 0; y < _height; y++) {
+        for (int x = 0; x < _width; x++) {
+            totalWeight += getWeight(x, y);
+        }
+    }
+    float meanWeight = (float) (totalWeight / ((double) _width * _height));
+
+    for (int y = 0; y < _height; y++) {
+        for (int x = 0; x < _width; x++) {
+            Vector3f color;
+            float weight = getWeight(x, y);
+            if (weight > 0) {
+                color = getSum(x, y) / weight;
+            }
+            if (meanWeight > 0) {
+                color += getSplatSum(x, y) / meanWeight;
+            }
+            image.setPixel(x, y, color);
+        }
+    }
+    return image;
+}
+
+std::vector<float>
+AccumulationImage::getFloats() const {
+    std::vector<float> values(_data.size() + _splats.size());
+    for (size_t i = 0; i < _data.size(); i++) {
+        values[i] = _data[i].load(std::memory_order_relaxed);
+    }
+    for (size_t i = 0; i < _splats.size(); i++) {
+        values[_data.size() + i] = _splats[i].load(std::memory_order_relaxed);
+    }
+    return values;
+}
+
+void
+AccumulationImage::addFloats(const std::vector<float> &values) {
+    assert(values.size() == _data.size() + _splats.size());
+    for (size_t i = 0; i < _data.size(); i++) {
+        atomicAdd(_data[i], values[i]);
+    }
+    for (size_t i = 0; i < _splats.size(); i++) {
+        atomicAdd(_splats[i], values[_data.size() + i]);
+    }
+}
+
+// Luminance below which relative errors are measured against this value.
+static const float min_relative_luminance = 0.01f;
+
+void
+PassStatistics::addPass(const AccumulationImage &film) {
+    for (int y = 0; y < _height; y++) {
+        for (int x = 0; x < _width; x++) {
+            int i = y * _width + x;
+            float sum = VecUtils::luminance(film.getSum(x, y) + film.getSplatSum(x, y));
+            float weight = film.getWeight(x, y);
+            if (weight <= _lastWeight[i]) {
+                continue;
+            }
+            double value = (sum - _lastSum[i]) / (weight - _lastWeight[i]);
+            _lastSum[i] = sum;
+            _lastWeight[i] = weight;
+            // One NaN would make the pixel's mean and variance NaN for good,
+            // and no stopping rule could compare against them.
+            if (!std::isfinite(value)) {
+                continue;
+            }
+
+            _passes[i]++;
+            double delta = value - _mean[i];
+            _mean[i] += delta / _passes[i];
+            _m2[i] += delta * (value - _mean[i]);
+        }
+    }
+}
+
+void
+PassStatistics::startFrom(const AccumulationImage &film) {
+    for (int y = 0; y < _height; y++) {
+        for (int x = 0; x < _width; x++) {
+            int i = y * _width + x;
+            _lastSum[i] = VecUtils::luminance(film.getSum(x, y) + film.getSplatSum(x, y));
+            _lastWeight[i] = film.getWeight(x, y);
+        }
+    }
+}
+
+float
+PassStatistics::standardError(int x, int y) const {
+    int i = y * _width + x;
+    int n = _passes[i];
+    if (n < 2) {
+        return 0;
+    }
+    return (float) std::sqrt(_m2[i] / (n - 1) / n);
+}
+
+float
+PassStatistics::relativeError(int x, int y) const {
+    int i = y * _width + x;
+    if (_passes[i] < 2) {
+        return std::numeric_limits<float>::infinity();
+    }
+    return (float) (standardError(x, y) / std::max(std::fabs(_mean[i]), (double) min_relative_luminance));
+}
+
+float
+PassStatistics::maxRelativeError(int x0, int y0, int x1, int y1) const {
+    float result = 0;
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+            result = std::max(result, relativeError(x, y));
+        }
+    }
+    return result;
+}
+
+float
+PassStatistics::rmsRelativeError(int x0, int y0, int x1, int y1) const {
+    double sum = 0;
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+            float error = relativeError(x, y);
+            sum += (double) error * error;
+        }
+    }
+    int n = (x1 - x0) * (y1 - y0);
+    return n > 0 ? (float) std::sqrt(sum / n) : 0.f;
+}
+
+float
+PassStatistics::rmsStandardError(int x0, int y0, int x1, int y1) const {
+    double sum = 0;
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+            float error = standardError(x, y);
+            sum += (double) error * error;
+        }
+    }
+    int n = (x1 - x0) * (y1 - y0);
+    return n > 0 ? (float) std::sqrt(sum / n) : 0.f;
+}
+
 void
 Image::savePNG(const std::string &filename) const {
     assert(!filename.empty());
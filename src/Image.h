@@ -1,11 +1,13 @@
 #ifndef IMAGE_H
 #define IMAGE_H
 
+#include <atomic>
 #include <cassert>
 #include <string>
 #include <vector>
 
 #include "vecmath.h"
+#include "VecUtils.h"
 
 // Simple image class
 class Image {
@@ -66,4 +68,155 @@ private:
     std::vector<Vector3f> _data;
 };
 
+// Image of weighted sums that every thread can add to without locks. Each
+// pixel keeps the sum of the weighted colors added to it and the sum of
+// their weights. Additions arrive in any order, so with several threads the
+// last bits of a pixel can vary from run to run.
+//
+// Splats, light that samples of other pixels carry to a pixel, are kept
+// apart and averaged over the mean weight of all pixels, since they come
+// from every pixel's samples whatever the pixel's own sample count.
+class AccumulationImage {
+public:
+    AccumulationImage(int w, int h) :
+            _width(w),
+            _height(h),
+            _data(4 * w * h),
+            _splats(3 * w * h) {}
+
+    int getWidth() const {
+        return _width;
+    }
+
+    int getHeight() const {
+        return _height;
+    }
+
+    // Adds color, already multiplied by its weight, and the weight. A color
+    // that is not finite would stay in the pixel for good, so it counts as
+    // black.
+    void addSample(int x, int y, const Vector3f &weightedColor, float weight) {
+        assert(x >= 0 && x < _width);
+        assert(y >= 0 && y < _height);
+        std::atomic<float> *pixel = &_data[4 * (y * _width + x)];
+        if (VecUtils::isFinite(weightedColor)) {
+            for (int c = 0; c < 3; c++) {
+                atomicAdd(pixel[c], weightedColor[c]);
+            }
+        }
+        atomicAdd(pixel[3], weight);
+    }
+
+    // Adds a splat from some pixel's sample. Splats that are not finite are
+    // dropped.
+    void addSplat(int x, int y, const Vector3f &color) {
+        assert(x >= 0 && x < _width);
+        assert(y >= 0 && y < _height);
+        if (!VecUtils::isFinite(color)) {
+            return;
+        }
+        std::atomic<float> *pixel = &_splats[3 * (y * _width + x)];
+        for (int c = 0; c < 3; c++) {
+            atomicAdd(pixel[c], color[c]);
+        }
+    }
+
+    // Sum of the weighted colors added to pixel (x, y).
+    Vector3f getSum(int x, int y) const {
+        const std::atomic<float> *pixel = &_data[4 * (y * _width + x)];
+        return Vector3f(pixel[0].load(std::memory_order_relaxed), pixel[1].load(std::memory_order_relaxed),
+                        pixel[2].load(std::memory_order_relaxed));
+    }
+
+    // Sum of the splats added to pixel (x, y).
+    Vector3f getSplatSum(int x, int y) const {
+        const std::atomic<float> *pixel = &_splats[3 * (y * _width + x)];
+        return Vector3f(pixel[0].load(std::memory_order_relaxed), pixel[1].load(std::memory_order_relaxed),
+                        pixel[2].load(std::memory_order_relaxed));
+    }
+
+    // Sum of the weights added to pixel (x, y).
+    float getWeight(int x, int y) const {
+        return _data[4 * (y * _width + x) + 3].load(std::memory_order_relaxed);
+    }
+
+    // Every sum the film keeps: the weighted colors and weights, 4 floats
+    // per pixel, then the splats, 3 floats per pixel.
+    std::vector<float> getFloats() const;
+
+    // Adds sums laid out as getFloats returns them.
+    void addFloats(const std::vector<float> &values);
+
+    // Weighted average of the samples added to each pixel, black for pixels
+    // without weight, plus the pixel's splats over the mean weight.
+    Image resolve() const;
+
+private:
+    static void atomicAdd(std::atomic<float> &a, float value) {
+        float old = a.load(std::memory_order_relaxed);
+        while (!a.compare_exchange_weak(old, old + value, std::memory_order_relaxed)) {
+        }
+    }
+
+    int _width;
+    int _height;
+    std::vector<std::atomic<float>> _data;
+    std::vector<std::atomic<float>> _splats;
+};
+
+// Running mean and variance of each pixel's luminance over the passes of a
+// progressive render, by Welford's algorithm. A pixel's value for one pass
+// is the mean of what the pass added to it, splats included, so the spread
+// of those values gives the standard error of the film's estimate. Splats
+// count toward the pass that added them.
+class PassStatistics {
+public:
+    PassStatistics(int w, int h) :
+            _width(w),
+            _height(h),
+            _lastSum(w * h, 0.f),
+            _lastWeight(w * h, 0.f),
+            _passes(w * h, 0),
+            _mean(w * h, 0.),
+            _m2(w * h, 0.) {}
+
+    // Adds the samples that reached the film since the previous call. Pixels
+    // that took no new weight keep their statistics.
+    void addPass(const AccumulationImage &film);
+
+    // Takes the film's sums as they stand as the start of the next pass,
+    // for a film that already holds samples.
+    void startFrom(const AccumulationImage &film);
+
+    // Standard error of pixel (x, y)'s mean, or zero before the pixel has
+    // seen two passes.
+    float standardError(int x, int y) const;
+
+    // Standard error of pixel (x, y)'s mean over the mean itself, or
+    // infinity before the pixel has seen two passes. Pixels darker than a
+    // small floor are measured against the floor, so black pixels converge.
+    float relativeError(int x, int y) const;
+
+    // Largest relative error over the pixels [x0, x1) x [y0, y1).
+    float maxRelativeError(int x0, int y0, int x1, int y1) const;
+
+    // Root mean square of the relative errors over the pixels
+    // [x0, x1) x [y0, y1).
+    float rmsRelativeError(int x0, int y0, int x1, int y1) const;
+
+    // Root mean square of the pixels' standard errors over
+    // [x0, x1) x [y0, y1), counting pixels without two passes as zero.
+    float rmsStandardError(int x0, int y0, int x1, int y1) const;
+
+private:
+    int _width;
+    int _height;
+    // Luminance of the film's sums, and the film's weights, at the last pass.
+    std::vector<float> _lastSum;
+    std::vector<float> _lastWeight;
+    std::vector<int> _passes;
+    std::vector<double> _mean;
+    std::vector<double> _m2;
+};
+
 #endif // IMAGE_H
@@ -24,7 +24,8 @@ public:
             _shininess(shininess),
             _light(light),
             _transColor(transColor),
-            _refIndex(refIndex) {}
+            _refIndex(refIndex),
+            _id(-1) {}
 
     const Vector3f &getDiffuseColor() const {
         return _diffuseColor;
@@ -50,6 +51,15 @@ public:
         return _refIndex;
     }
 
+    // Index of the material in the scene, or -1 if it was not parsed from one.
+    int getId() const {
+        return _id;
+    }
+
+    void setId(int id) {
+        _id = id;
+    }
+
     Vector3f shade(const Ray &ray,
                    const Hit &hit,
                    const Vector3f &dirToLight);
@@ -61,6 +71,7 @@ protected:
     Vector3f _light;
     float _shininess;
     float _refIndex;
+    int _id;
 };
 
 #endif // MATERIAL_H
@@ -1,131 +1,263 @@
 #include "Mesh.h"
 
-#include <fstream>
-#include <iostream>
-#include <algorithm>
+#include "ObjParser.h"
+
 #include <cstdlib>
+#include <cstring>
+#include <iostream>
 #include <utility>
-#include <sstream>
+
+static_assert(sizeof(int) == sizeof(int32_t), "mesh caches store indices as 32-bit integers");
+
+// Whether to print each mesh's acceleration structure statistics, which
+// scripts/bench.py asks for by setting METROCASTER_MESH_STATS=1. They are
+// left out otherwise, since every daemon worker and shard loads the meshes.
+static bool
+reportMeshStats() {
+    const char *value = getenv("METROCASTER_MESH_STATS");
+    return value && *value && strcmp(value, "0") != 0;
+}
 
 Mesh::Mesh(const std::string &filename, Material *material) :
-        Object3D(material) {
-    std::ifstream f;
-    f.open(filename.c_str());
-    if (!f.is_open()) {
-        std::cout << "Cannot open " << filename << "\n";
+        Object3D(material),
+        _vertices(nullptr),
+        _normals(nullptr),
+        _indices(nullptr),
+        _numTriangles(0) {
+#if MESH_USE_OCTREE
+    if (!readObj(filename)) {
         return;
     }
-
-    std::vector<Vector3f> v;
-    std::vector<ObjTriangle> t;
-    std::vector<Vector3f> n;
-    std::vector<Vector2f> texCoord;
-
-    const std::string vTok("v");
-    const std::string fTok("f");
-    const std::string texTok("vt");
-    const char bslash = '/', space = ' ';
-    std::string tok;
-    std::string line;
-    while (true) {
-        std::getline(f, line);
-        if (f.eof()) {
-            break;
-        }
-        if (line.size() < 3) {
-            continue;
-        }
-        if (line.at(0) == '#') {
-            continue;
+    octree.build(this);
+    if (reportMeshStats()) {
+        std::cout << "Octree: " << octree.getNumNodes() << " nodes, "
+                  << octree.getNumTrigRefs() << " triangle refs, "
+                  << octree.memoryUsage() / 1024.0 << " KB\n";
+    }
+#else
+    std::string cacheFile = filename + ".mcache";
+    uint64_t size = 0;
+    MeshSourceStamp stamp;
+    uint64_t hash = 0;
+    bool hashed = false;
+    bool cached = statSourceFile(filename, size, stamp) &&
+                  loadCache(cacheFile, filename, size, stamp, hash, hashed);
+    if (!cached) {
+        if (!readObj(filename)) {
+            return;
         }
-        std::stringstream ss(line);
-        ss >> tok;
-        if (tok == vTok) {
-            Vector3f vec;
-            ss >> vec[0] >> vec[1] >> vec[2];
-            v.push_back(vec);
-        } else if (tok == fTok) {
-            if (line.find(bslash) != std::string::npos) {
-                std::replace(line.begin(), line.end(), bslash, space);
-                std::stringstream facess(line);
-                ObjTriangle trig;
-                facess >> tok;
-                for (int ii = 0; ii < 3; ii++) {
-                    facess >> trig[ii] >> trig.texID[ii];
-                    trig[ii]--;
-                    trig.texID[ii]--;
-                }
-                t.push_back(trig);
-            } else {
-                ObjTriangle trig;
-                for (int ii = 0; ii < 3; ii++) {
-                    ss >> trig[ii];
-                    trig[ii]--;
-                    trig.texID[ii] = 0;
-                }
-                t.push_back(trig);
-            }
-        } else if (tok == texTok) {
-            Vector2f texcoord;
-            ss >> texcoord[0];
-            ss >> texcoord[1];
-            texCoord.push_back(texcoord);
+        bvh.build(*this);
+    }
+    if (reportMeshStats()) {
+        std::cout << "BVH4 (" << bvh.getKernelName() << "): " << bvh.getNumNodes() << " nodes, "
+                  << bvh.getNumPackets() << " triangle packets, "
+                  << bvh.memoryUsage() / 1024.0 << " KB" << (cached ? ", cached\n" : "\n");
+    }
+    if (!cached && (hashed || hashSourceFile(filename, hash))) {
+        saveCache(cacheFile, hash, size, stamp);
+    }
+#endif
+}
+
+#if !MESH_USE_OCTREE
+bool
+Mesh::loadCache(const std::string &cacheFile, const std::string &filename, uint64_t sourceSize,
+                const MeshSourceStamp &sourceStamp, uint64_t &sourceHash, bool &hashed) {
+    if (!_cache.open(cacheFile)) {
+        return false;
+    }
+    const MeshCacheHeader &header = *(const MeshCacheHeader *) _cache.data();
+    bool ok = checkMeshCacheHeader(header, _cache.size()) &&
+              header.node_size == WideBVH::nodeSize() &&
+              header.source_size == sourceSize &&
+              header.normals.count == header.vertices.count &&
+              header.indices.count % 3 == 0 &&
+              header.trig_indices.count == 4 * header.packets.count;
+    // The contents are hashed only if the file's stamp changed, so a warm
+    // load does not read the OBJ. A copied or touched file keeps its cache
+    // if the contents match.
+    if (ok && !(header.source_stamp == sourceStamp)) {
+        hashed = hashed || hashSourceFile(filename, sourceHash);
+        ok = hashed && header.source_hash == sourceHash;
+        if (ok) {
+            // Later loads skip the hash again.
+            restampMeshCache(cacheFile, sourceStamp);
         }
     }
-    f.close();
+    if (!ok) {
+        _cache.close();
+        return false;
+    }
+
+    const char *base = _cache.data();
+    _vertices = (const Vector3f *) (base + header.vertices.offset);
+    _normals = (const Vector3f *) (base + header.normals.offset);
+    _indices = (const int *) (base + header.indices.offset);
+    _numTriangles = (int) (header.indices.count / 3);
+    _box = Box(header.box_min[0], header.box_min[1], header.box_min[2],
+               header.box_max[0], header.box_max[1], header.box_max[2]);
+    bvh.attach(base + header.nodes.offset, header.nodes.count, base + header.packets.offset,
+               header.packets.count, (const int32_t *) (base + header.trig_indices.offset));
+    return true;
+}
+
+void
+Mesh::saveCache(const std::string &cacheFile, uint64_t sourceHash, uint64_t sourceSize,
+                const MeshSourceStamp &sourceStamp) const {
+    MeshCacheHeader header;
+    initMeshCacheHeader(header);
+    header.node_size = (uint32_t) WideBVH::nodeSize();
+    header.source_hash = sourceHash;
+    header.source_size = sourceSize;
+    header.source_stamp = sourceStamp;
+    for (int dim = 0; dim < 3; dim++) {
+        header.box_min[dim] = _box.mn[dim];
+        header.box_max[dim] = _box.mx[dim];
+    }
+
+    MeshCacheWriter writer;
+    header.vertices = writer.add(_vertexData.data(), sizeof(Vector3f), _vertexData.size());
+    header.normals = writer.add(_normalData.data(), sizeof(Vector3f), _normalData.size());
+    header.indices = writer.add(_indexData.data(), sizeof(int32_t), _indexData.size());
+    header.nodes = writer.add(bvh.getNodeData(), WideBVH::nodeSize(), bvh.getNumNodes());
+    header.packets = writer.add(bvh.getPacketData(), sizeof(TrianglePacket4), bvh.getNumPackets());
+    header.trig_indices = writer.add(bvh.getTrigIndexData(), sizeof(int32_t), 4 * bvh.getNumPackets());
+    if (!writer.write(cacheFile, header)) {
+        // Renders still work, they only parse the file every time.
+        std::cout << "Could not write mesh cache " << cacheFile << "\n";
+    }
+}
+#endif
+
+bool
+Mesh::readObj(const std::string &filename) {
+    MappedFile file;
+    if (!file.open(filename)) {
+        std::cout << "Cannot open " << filename << "\n";
+        return false;
+    }
+    ObjGeometry geometry;
+    if (!parseObj(file.data(), file.size(), filename, geometry)) {
+        return false;
+    }
+    std::vector<Vector3f> &v = geometry.vertices;
+    std::vector<int> &t = geometry.indices;
+    int n_trigs = (int) t.size() / 3;
 
     // Compute normals
     // will smooth normals.
     // if sharp edges required, build OBJ with no shared vertices.
-    n.resize(v.size());
-    for (int ii = 0; ii < t.size(); ii++) {
-        Vector3f a = v[t[ii][1]] - v[t[ii][0]];
-        Vector3f b = v[t[ii][2]] - v[t[ii][0]];
+    std::vector<Vector3f> n(v.size());
+    for (int ii = 0; ii < n_trigs; ii++) {
+        const int *trig = &t[3 * ii];
+        Vector3f a = v[trig[1]] - v[trig[0]];
+        Vector3f b = v[trig[2]] - v[trig[0]];
         Vector3f normal = Vector3f::cross(a, b).normalized();
         for (int jj = 0; jj < 3; jj++) {
-            n[t[ii][jj]] += normal;
+            n[trig[jj]] += normal;
         }
     }
     for (int ii = 0; ii < v.size(); ii++) {
         n[ii] = n[ii] / n[ii].abs();
     }
 
-    // Set up triangles
-    for (int i = 0; i < t.size(); i++) {
-        Triangle triangle(v[t[i][0]],
-                          v[t[i][1]],
-                          v[t[i][2]],
-                          n[t[i][0]],
-                          n[t[i][1]],
-                          n[t[i][2]],
-                          getMaterial());
-        _triangles.push_back(triangle);
+    for (int index : t) {
+        _box.extend(v[index]);
     }
-
-    octree.build(this);
+#if MESH_USE_OCTREE
+    for (int dim = 0; dim < 3; dim++) {
+        _v0[dim].resize(n_trigs);
+        _e1[dim].resize(n_trigs);
+        _e2[dim].resize(n_trigs);
+    }
+    for (int i = 0; i < n_trigs; i++) {
+        const int *trig = &t[3 * i];
+        Vector3f e1 = v[trig[1]] - v[trig[0]];
+        Vector3f e2 = v[trig[2]] - v[trig[0]];
+        for (int dim = 0; dim < 3; dim++) {
+            _v0[dim][i] = v[trig[0]][dim];
+            _e1[dim][i] = e1[dim];
+            _e2[dim][i] = e2[dim];
+        }
+    }
+#endif
+    _vertexData = std::move(v);
+    _normalData = std::move(n);
+    _indexData = std::move(t);
+    _vertices = _vertexData.data();
+    _normals = _normalData.data();
+    _indices = _indexData.data();
+    _numTriangles = n_trigs;
+    return true;
 }
 
 bool
 Mesh::intersect(const Ray &r, float tmin, Hit &h) const {
-#if 1
-    ray = &r;
-    hit = &h;
-    tm = tmin;
-    return octree.intersect(r);
+#if MESH_USE_OCTREE
+    OctreeQuery query(r, tmin, h);
+    if (!octree.intersect(query)) {
+        return false;
+    }
+    float t = h.getT();
+    int trig = query.trig;
+    float beta = query.beta;
+    float gamma = query.gamma;
 #else
-    bool result = false;
-    for (Triangle t : _triangles) {
-        if (t.intersect(r, tmin, h)) {
-            result = true;
-        }
+    float t = h.getT();
+    int trig;
+    float beta, gamma;
+    if (!bvh.intersect(r, tmin, t, trig, beta, gamma)) {
+        return false;
     }
-    return result;
+#endif
+
+    // Interpolate the normal for the closest triangle only.
+    const int *idx = &_indices[3 * trig];
+    Vector3f normal = (1 - beta - gamma) * _normals[idx[0]]
+                      + beta * _normals[idx[1]]
+                      + gamma * _normals[idx[2]];
+    normal.normalize();
+    h.set(t, getMaterial(), normal);
+    return true;
+}
+
+bool
+Mesh::occluded(const Ray &r, float tmin, float tmax) const {
+#if MESH_USE_OCTREE
+    Hit h(tmax, NULL, Vector3f());
+    OctreeQuery query(r, tmin, h);
+    query.any_hit = true;
+    return octree.intersect(query);
+#else
+    return bvh.occluded(r, tmin, tmax);
 #endif
 }
 
 bool
-Mesh::intersectTrig(int idx, const Ray &r) const {
-    const Triangle &triangle = _triangles[idx];
-    bool result = triangle.intersect(r, tm, *hit);
-    return result;
+Mesh::getBounds(Box &box) const {
+    if (_numTriangles == 0) {
+        return false;
+    }
+    box = _box;
+    return true;
 }
+
+#if MESH_USE_OCTREE
+bool
+Mesh::intersectTrig(int idx, OctreeQuery &query) const {
+    Vector3f v0(_v0[0][idx], _v0[1][idx], _v0[2][idx]);
+    Vector3f e1(_e1[0][idx], _e1[1][idx], _e1[2][idx]);
+    Vector3f e2(_e2[0][idx], _e2[1][idx], _e2[2][idx]);
+
+    float t, beta, gamma;
+    if (!Triangle::intersect(query.ray.getOrigin(), query.ray.getDirection(), v0, e1, e2,
+                             query.tmin, query.hit.getT(), t, beta, gamma)) {
+        return false;
+    }
+    query.hit.t = t;
+    query.trig = idx;
+    query.beta = beta;
+    query.gamma = gamma;
+    return true;
+}
+#endif
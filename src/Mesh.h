@@ -1,14 +1,23 @@
 #ifndef MESH_H
 #define MESH_H
 
+#include "MeshCache.h"
 #include "Object3D.h"
-#include "ObjTriangle.h"
-#include "Octree.h"
-#include "Vector2f.h"
 #include "Vector3f.h"
+#include "WideBVH.h"
 
 #include <vector>
 
+// Meshes are intersected through the SIMD wide BVH, which is kept in a
+// mesh cache next to the OBJ file. Set to 1 to use the octree instead.
+#ifndef MESH_USE_OCTREE
+#define MESH_USE_OCTREE 0
+#endif
+
+#if MESH_USE_OCTREE
+#include "Octree.h"
+#endif
+
 class Mesh : public Object3D {
 public:
     Mesh(const std::string &filename, Material *m);
@@ -17,18 +26,64 @@ public:
 
     virtual bool intersect(const Ray &r, float tmin, Hit &h) const;
 
-    virtual bool intersectTrig(int idx, const Ray &r) const;
+    virtual bool occluded(const Ray &r, float tmin, float tmax) const override;
+
+    virtual bool getBounds(Box &box) const override;
 
-    const std::vector<Triangle> &getTriangles() const {
-        return _triangles;
+#if MESH_USE_OCTREE
+    // Tests one triangle against the ray of an in-flight octree query.
+    bool intersectTrig(int idx, OctreeQuery &query) const;
+#endif
+
+    int getNumTriangles() const {
+        return _numTriangles;
+    }
+
+    const Vector3f &getVertex(int trig, int index) const {
+        assert(index < 3);
+        return _vertices[_indices[3 * trig + index]];
     }
 
 private:
-    std::vector<Triangle> _triangles;
-    mutable Octree octree;
-    mutable const Ray *ray;
-    mutable Hit *hit;
-    mutable float tm;
+    // Reads the OBJ file into the owned arrays. Returns false, with a
+    // message, if it cannot be opened or parsed.
+    bool readObj(const std::string &filename);
+
+#if !MESH_USE_OCTREE
+    // Maps the cache and uses its arrays if it was made from the OBJ file as
+    // it is now. A source whose stamp changed is hashed, and hashed is set
+    // once sourceHash holds its hash.
+    bool loadCache(const std::string &cacheFile, const std::string &filename, uint64_t sourceSize,
+                   const MeshSourceStamp &sourceStamp, uint64_t &sourceHash, bool &hashed);
+
+    void saveCache(const std::string &cacheFile, uint64_t sourceHash, uint64_t sourceSize,
+                   const MeshSourceStamp &sourceStamp) const;
+#endif
+
+    // Shared vertices and smoothed normals, indexed three per triangle. They
+    // point into the vectors below, or into the mapped cache.
+    const Vector3f *_vertices;
+    const Vector3f *_normals;
+    const int *_indices;
+    int _numTriangles;
+
+    std::vector<Vector3f> _vertexData;
+    std::vector<Vector3f> _normalData;
+    std::vector<int> _indexData;
+    MappedFile _cache;
+
+    Box _box;
+#if MESH_USE_OCTREE
+    // Per-triangle first vertex and edges for the octree's intersection
+    // loop, stored as one array per component.
+    std::vector<float> _v0[3];
+    std::vector<float> _e1[3];
+    std::vector<float> _e2[3];
+
+    Octree octree;
+#else
+    WideBVH bvh;
+#endif
 };
 
 #endif
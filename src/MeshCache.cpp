@@ -0,0 +1,222 @@
+#include "MeshCache.h"
+
+#include "SimdKernels.h"
+#include "Vector3f.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static const char mesh_cache_magic[4] = {'M', 'C', 'M', 'H'};
+static const uint32_t mesh_cache_version = 4;
+static const uint32_t mesh_cache_byte_order = 0x01020304;
+
+// Arrays start on this boundary, which covers the BVH nodes' alignment.
+static const size_t section_alignment = 64;
+
+static_assert(sizeof(Vector3f) == 3 * sizeof(float), "vertices are stored as three floats");
+
+static size_t
+alignUp(size_t n) {
+    return (n + section_alignment - 1) / section_alignment * section_alignment;
+}
+
+// The header fills the start of the file up to the first array.
+static size_t
+headerBytes() {
+    return alignUp(sizeof(MeshCacheHeader));
+}
+
+void
+initMeshCacheHeader(MeshCacheHeader &header) {
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, mesh_cache_magic, sizeof(header.magic));
+    header.version = mesh_cache_version;
+    header.byte_order = mesh_cache_byte_order;
+    header.vertex_size = sizeof(Vector3f);
+    header.packet_size = sizeof(TrianglePacket4);
+}
+
+static bool
+sectionFits(const MeshCacheSection &section, size_t elementSize, size_t fileSize) {
+    return section.offset % section_alignment == 0 && section.offset <= fileSize &&
+           section.count <= (fileSize - section.offset) / elementSize;
+}
+
+bool
+checkMeshCacheHeader(const MeshCacheHeader &header, size_t fileSize) {
+    return fileSize >= headerBytes() &&
+           memcmp(header.magic, mesh_cache_magic, sizeof(header.magic)) == 0 &&
+           header.version == mesh_cache_version &&
+           header.byte_order == mesh_cache_byte_order &&
+           header.vertex_size == sizeof(Vector3f) &&
+           header.packet_size == sizeof(TrianglePacket4) &&
+           header.node_size > 0 &&
+           sectionFits(header.vertices, sizeof(Vector3f), fileSize) &&
+           sectionFits(header.normals, sizeof(Vector3f), fileSize) &&
+           sectionFits(header.indices, sizeof(int32_t), fileSize) &&
+           sectionFits(header.nodes, header.node_size, fileSize) &&
+           sectionFits(header.packets, sizeof(TrianglePacket4), fileSize) &&
+           sectionFits(header.trig_indices, sizeof(int32_t), fileSize);
+}
+
+bool
+statSourceFile(const std::string &filename, uint64_t &size, MeshSourceStamp &stamp) {
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0) {
+        return false;
+    }
+    size = (uint64_t) st.st_size;
+#if defined(__APPLE__)
+    stamp.mtime_ns = (int64_t) st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+    stamp.ctime_ns = (int64_t) st.st_ctimespec.tv_sec * 1000000000 + st.st_ctimespec.tv_nsec;
+#elif defined(_WIN32)
+    stamp.mtime_ns = (int64_t) st.st_mtime * 1000000000;
+    stamp.ctime_ns = (int64_t) st.st_ctime * 1000000000;
+#else
+    stamp.mtime_ns = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    stamp.ctime_ns = (int64_t) st.st_ctim.tv_sec * 1000000000 + st.st_ctim.tv_nsec;
+#endif
+    stamp.inode = (uint64_t) st.st_ino;
+    return true;
+}
+
+bool
+hashSourceFile(const std::string &filename, uint64_t &hash) {
+    FILE *file = fopen(filename.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    // 64-bit FNV-1a.
+    uint64_t h = 0xcbf29ce484222325ULL;
+    unsigned char buffer[1 << 16];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            h ^= buffer[i];
+            h *= 0x100000001b3ULL;
+        }
+    }
+    bool ok = !ferror(file);
+    fclose(file);
+    hash = h;
+    return ok;
+}
+
+bool
+restampMeshCache(const std::string &filename, const MeshSourceStamp &stamp) {
+    FILE *file = fopen(filename.c_str(), "r+b");
+    if (!file) {
+        return false;
+    }
+    bool ok = fseek(file, (long) offsetof(MeshCacheHeader, source_stamp), SEEK_SET) == 0 &&
+              fwrite(&stamp, sizeof(stamp), 1, file) == 1;
+    return fclose(file) == 0 && ok;
+}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+void
+MappedFile::close() {
+#ifndef _WIN32
+    if (_data && _buffer.empty()) {
+        munmap((void *) _data, _size);
+    }
+#endif
+    _buffer.clear();
+    _buffer.shrink_to_fit();
+    _data = nullptr;
+    _size = 0;
+}
+
+bool
+MappedFile::open(const std::string &filename) {
+    close();
+#ifdef _WIN32
+    FILE *file = fopen(filename.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (size <= 0) {
+        fclose(file);
+        return false;
+    }
+    _buffer.resize((size_t) size);
+    bool ok = fread(_buffer.data(), 1, _buffer.size(), file) == _buffer.size();
+    fclose(file);
+    if (!ok) {
+        _buffer.clear();
+        return false;
+    }
+    _data = _buffer.data();
+    _size = _buffer.size();
+    return true;
+#else
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ::close(fd);
+        return false;
+    }
+    // The mapping keeps the file open after the descriptor is closed.
+    void *data = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    _data = (const char *) data;
+    _size = (size_t) st.st_size;
+    return true;
+#endif
+}
+
+MeshCacheSection
+MeshCacheWriter::add(const void *data, size_t elementSize, size_t count) {
+    _body.resize(alignUp(_body.size()));
+    MeshCacheSection section;
+    section.offset = headerBytes() + _body.size();
+    section.count = count;
+    const char *bytes = (const char *) data;
+    _body.insert(_body.end(), bytes, bytes + elementSize * count);
+    return section;
+}
+
+bool
+MeshCacheWriter::write(const std::string &filename, const MeshCacheHeader &header) const {
+    // Renders started together may write the same cache, so each writes
+    // its own partial file.
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%llx.part",
+             (unsigned long long) std::chrono::steady_clock::now().time_since_epoch().count());
+    std::string partial = filename + suffix;
+    FILE *file = fopen(partial.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+
+    std::vector<char> head(headerBytes(), 0);
+    memcpy(head.data(), &header, sizeof(header));
+    bool ok = fwrite(head.data(), 1, head.size(), file) == head.size() &&
+              fwrite(_body.data(), 1, _body.size(), file) == _body.size();
+    ok = fclose(file) == 0 && ok;
+    if (!ok || std::rename(partial.c_str(), filename.c_str()) != 0) {
+        std::remove(partial.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,127 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include "AlignedAllocator.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A mesh cache holds a parsed mesh and its BVH, in the writing machine's
+// byte order, next to the OBJ file it was made from. Every array starts on
+// a 64-byte boundary, so a mapped cache is used in place without copying.
+
+// When a source file's stamp is unchanged, so are its contents. The change
+// time is part of it because it cannot be set back, unlike the
+// modification time, which cp -p and touch -r copy.
+struct MeshSourceStamp {
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+    uint64_t inode;
+};
+
+inline bool
+operator==(const MeshSourceStamp &a, const MeshSourceStamp &b) {
+    return a.mtime_ns == b.mtime_ns && a.ctime_ns == b.ctime_ns && a.inode == b.inode;
+}
+
+// Array stored in a mesh cache: byte offset from the start of the file and
+// element count.
+struct MeshCacheSection {
+    uint64_t offset;
+    uint64_t count;
+};
+
+struct MeshCacheHeader {
+    char magic[4];
+    uint32_t version;
+    // Reads back as another value on a machine of the other byte order.
+    uint32_t byte_order;
+    // Sizes of the stored structs, which may differ between compilers.
+    uint32_t vertex_size;
+    uint32_t node_size;
+    uint32_t packet_size;
+    // OBJ file the cache was made from: FNV-1a hash of its contents, and
+    // its stamp when the cache was written.
+    uint64_t source_hash;
+    uint64_t source_size;
+    MeshSourceStamp source_stamp;
+    float box_min[3];
+    float box_max[3];
+    MeshCacheSection vertices;
+    MeshCacheSection normals;
+    MeshCacheSection indices;
+    MeshCacheSection nodes;
+    MeshCacheSection packets;
+    MeshCacheSection trig_indices;
+};
+
+// Fills the identification fields of a header for this build.
+void initMeshCacheHeader(MeshCacheHeader &header);
+
+// Whether the header was written by a build with the same layout, and all
+// of its sections lie inside a file of fileSize bytes.
+bool checkMeshCacheHeader(const MeshCacheHeader &header, size_t fileSize);
+
+// Size and stamp of a file. Returns false if it is missing.
+bool statSourceFile(const std::string &filename, uint64_t &size, MeshSourceStamp &stamp);
+
+// FNV-1a hash of a file's contents. Returns false if it cannot be read.
+bool hashSourceFile(const std::string &filename, uint64_t &hash);
+
+// Whole file mapped read-only into memory, or read into an aligned buffer
+// where mapping is not available. The contents stay valid until the object
+// is destroyed.
+class MappedFile {
+public:
+    MappedFile() :
+            _data(nullptr),
+            _size(0) {}
+
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // Returns false if the file cannot be opened or is empty.
+    bool open(const std::string &filename);
+
+    void close();
+
+    const char *data() const {
+        return _data;
+    }
+
+    size_t size() const {
+        return _size;
+    }
+
+private:
+    const char *_data;
+    size_t _size;
+    std::vector<char, AlignedAllocator<char>> _buffer;
+};
+
+// Rewrites the source stamp in the header of the cache at filename, for a
+// source that was touched or copied without changing. Returns false if the
+// file cannot be written.
+bool restampMeshCache(const std::string &filename, const MeshSourceStamp &stamp);
+
+// Collects the arrays of a mesh cache and writes them out.
+class MeshCacheWriter {
+public:
+    // Adds count elements of elementSize bytes and returns their section.
+    MeshCacheSection add(const void *data, size_t elementSize, size_t count);
+
+    // Writes the header and the arrays next to the file and renames the
+    // result into place, so a reader never sees a partial cache. Returns
+    // false if the file cannot be written.
+    bool write(const std::string &filename, const MeshCacheHeader &header) const;
+
+private:
+    std::vector<char> _body;
+};
+
+#endif // MESH_CACHE_H
@@ -0,0 +1,285 @@
+#include "ObjParser.h"
+
+#include "iterator.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Text per chunk. Chunks are the unit of parallel work. The parser's test
+// sets a few dozen bytes, so that small files span many chunks.
+#ifndef OBJ_CHUNK_BYTES
+#define OBJ_CHUNK_BYTES (1 << 20)
+#endif
+static const size_t chunk_bytes = OBJ_CHUNK_BYTES;
+
+namespace {
+    // Records of one chunk of the file.
+    struct ObjChunk {
+        ObjChunk() :
+                bad_line(nullptr) {}
+
+        std::vector<Vector3f> vertices;
+        // Indices counted from zero. Negative OBJ indices depend on the
+        // vertices before the chunk, which are not known while it is
+        // parsed, so the ones at the positions in relative are counted from
+        // the chunk's first vertex instead.
+        std::vector<int> indices;
+        std::vector<size_t> relative;
+        // First line with a face that does not parse.
+        const char *bad_line;
+    };
+}
+
+static inline bool
+isBlank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline bool
+isDigit(char c) {
+    return (unsigned) (c - '0') < 10;
+}
+
+static inline void
+skipBlanks(const char *&p, const char *end) {
+    while (p < end && isBlank(*p)) {
+        p++;
+    }
+}
+
+// Powers of ten that a float holds exactly.
+static const float exact_powers[] = {
+        1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f
+};
+static const int max_exact_power = 10;
+
+// Parses the number at p as strtof does and moves p past it. A decimal
+// whose digits fit in a float's mantissa, scaled by an exact power of ten,
+// takes one correctly rounded float multiplication or division. Rounding in
+// double first and then to float can be off by one in the last place, so
+// other numbers, and words such as nan, go to strtof.
+static float
+parseFloat(const char *&p, const char *end) {
+    const char *start = p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+
+    // Digits are collected while they fit; any past 2^24 send the number to
+    // strtof.
+    const uint64_t max_mantissa = ((uint64_t) 1 << 24) / 10;
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    bool any_digits = false;
+    bool exact = true;
+    while (p < end && isDigit(*p)) {
+        if (mantissa <= max_mantissa) {
+            mantissa = 10 * mantissa + (*p - '0');
+        } else {
+            exact = false;
+        }
+        any_digits = true;
+        p++;
+    }
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && isDigit(*p)) {
+            if (mantissa <= max_mantissa) {
+                mantissa = 10 * mantissa + (*p - '0');
+                exponent--;
+            } else {
+                exact = false;
+            }
+            any_digits = true;
+            p++;
+        }
+    }
+    if (any_digits && p < end && (*p == 'e' || *p == 'E')) {
+        const char *q = p + 1;
+        bool negative_exponent = false;
+        if (q < end && (*q == '-' || *q == '+')) {
+            negative_exponent = *q == '-';
+            q++;
+        }
+        if (q < end && isDigit(*q)) {
+            int e = 0;
+            while (q < end && isDigit(*q)) {
+                e = std::min(10 * e + (*q - '0'), 100000);
+                q++;
+            }
+            exponent += negative_exponent ? -e : e;
+            p = q;
+        }
+    }
+
+    if (any_digits && exact && mantissa < ((uint64_t) 1 << 24) &&
+        exponent >= -max_exact_power && exponent <= max_exact_power) {
+        float value = (float) mantissa;
+        value = exponent < 0 ? value / exact_powers[-exponent] : value * exact_powers[exponent];
+        return negative ? -value : value;
+    }
+
+    // strtof needs the word on its own.
+    const char *stop = start;
+    while (stop < end && !isBlank(*stop) && *stop != '\n') {
+        stop++;
+    }
+    std::string word(start, stop);
+    p = stop;
+    return strtof(word.c_str(), nullptr);
+}
+
+// Parses a face corner at p and moves p past it: a position index, then
+// texture and normal indices after slashes, which are skipped. Returns
+// false if it does not start with a nonzero integer.
+static bool
+parseCorner(const char *&p, const char *end, int64_t &index) {
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+    if (p == end || !isDigit(*p)) {
+        return false;
+    }
+    int64_t value = 0;
+    while (p < end && isDigit(*p)) {
+        value = std::min(10 * value + (*p - '0'), (int64_t) INT32_MAX);
+        p++;
+    }
+    while (p < end && !isBlank(*p) && *p != '\n') {
+        p++;
+    }
+    index = negative ? -value : value;
+    return value != 0;
+}
+
+static void
+parseChunk(const char *p, const char *end, ObjChunk &chunk) {
+    // Corners of the current face, and whether each is relative.
+    std::vector<int> corners;
+    std::vector<bool> relative;
+    while (p < end) {
+        skipBlanks(p, end);
+        const char *line = p;
+        if (end - p >= 2 && p[0] == 'v' && isBlank(p[1])) {
+            p++;
+            Vector3f v;
+            for (int dim = 0; dim < 3; dim++) {
+                skipBlanks(p, end);
+                if (p < end && *p != '\n') {
+                    v[dim] = parseFloat(p, end);
+                }
+            }
+            chunk.vertices.push_back(v);
+        } else if (end - p >= 2 && p[0] == 'f' && isBlank(p[1])) {
+            p++;
+            corners.clear();
+            relative.clear();
+            while (true) {
+                skipBlanks(p, end);
+                if (p == end || *p == '\n') {
+                    break;
+                }
+                int64_t index;
+                if (!parseCorner(p, end, index)) {
+                    if (!chunk.bad_line) {
+                        chunk.bad_line = line;
+                    }
+                    corners.clear();
+                    break;
+                }
+                if (index > 0) {
+                    corners.push_back((int) (index - 1));
+                    relative.push_back(false);
+                } else {
+                    corners.push_back((int) ((int64_t) chunk.vertices.size() + index));
+                    relative.push_back(true);
+                }
+            }
+            for (size_t k = 1; k + 1 < corners.size(); k++) {
+                size_t fan[3] = {0, k, k + 1};
+                for (size_t corner : fan) {
+                    if (relative[corner]) {
+                        chunk.relative.push_back(chunk.indices.size());
+                    }
+                    chunk.indices.push_back(corners[corner]);
+                }
+            }
+        }
+
+        const char *newline = (const char *) memchr(p, '\n', end - p);
+        p = newline ? newline + 1 : end;
+    }
+}
+
+bool
+parseObj(const char *data, size_t size, const std::string &filename, ObjGeometry &geometry) {
+    // Chunks end just after a line break, so no record is split.
+    const char *end = data + size;
+    size_t n_chunks = std::max((size_t) 1, (size + chunk_bytes - 1) / chunk_bytes);
+    std::vector<const char *> bounds(n_chunks + 1, end);
+    bounds[0] = data;
+    for (size_t i = 1; i < n_chunks; i++) {
+        const char *p = std::max(data + i * (size / n_chunks), bounds[i - 1]);
+        const char *newline = (const char *) memchr(p, '\n', end - p);
+        bounds[i] = newline ? newline + 1 : end;
+    }
+
+    std::vector<ObjChunk> chunks(n_chunks);
+    parallel_for((unsigned) n_chunks, [&](int start, int stop) {
+        for (int i = start; i < stop; i++) {
+            parseChunk(bounds[i], bounds[i + 1], chunks[i]);
+        }
+    });
+
+    for (const ObjChunk &chunk : chunks) {
+        if (chunk.bad_line) {
+            size_t line = 1 + std::count(data, chunk.bad_line, '\n');
+            printf("Bad face on line %zu of %s\n", line, filename.c_str());
+            return false;
+        }
+    }
+
+    // Where each chunk's records go in the whole mesh.
+    std::vector<size_t> firstVertex(n_chunks + 1, 0);
+    std::vector<size_t> firstIndex(n_chunks + 1, 0);
+    for (size_t i = 0; i < n_chunks; i++) {
+        firstVertex[i + 1] = firstVertex[i] + chunks[i].vertices.size();
+        firstIndex[i + 1] = firstIndex[i] + chunks[i].indices.size();
+    }
+    geometry.vertices.resize(firstVertex[n_chunks]);
+    geometry.indices.resize(firstIndex[n_chunks]);
+
+    std::vector<char> badIndex(n_chunks, 0);
+    int64_t n_vertices = (int64_t) firstVertex[n_chunks];
+    parallel_for((unsigned) n_chunks, [&](int start, int stop) {
+        for (int i = start; i < stop; i++) {
+            ObjChunk &chunk = chunks[i];
+            for (size_t k : chunk.relative) {
+                chunk.indices[k] += (int) firstVertex[i];
+            }
+            for (int index : chunk.indices) {
+                if (index < 0 || index >= n_vertices) {
+                    badIndex[i] = 1;
+                    break;
+                }
+            }
+            std::copy(chunk.vertices.begin(), chunk.vertices.end(), geometry.vertices.begin() + firstVertex[i]);
+            std::copy(chunk.indices.begin(), chunk.indices.end(), geometry.indices.begin() + firstIndex[i]);
+            std::vector<Vector3f>().swap(chunk.vertices);
+            std::vector<int>().swap(chunk.indices);
+        }
+    });
+
+    if (std::find(badIndex.begin(), badIndex.end(), 1) != badIndex.end()) {
+        printf("A face of %s refers to a vertex that does not exist\n", filename.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,27 @@
+#ifndef OBJ_PARSER_H
+#define OBJ_PARSER_H
+
+#include "Vector3f.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Geometry of an OBJ file: vertex positions and three vertex indices per
+// triangle, counted from zero. By default counterclockwise winding is the
+// front face.
+struct ObjGeometry {
+    std::vector<Vector3f> vertices;
+    std::vector<int> indices;
+};
+
+// Parses the v and f records of an OBJ file held in memory. Faces may give
+// v, v/vt, v//vn or v/vt/vn for each corner; only the position index is
+// kept, and negative indices count back from the latest vertex. Polygons
+// are split into a fan of triangles around their first corner. Other
+// records are skipped. The text is cut into chunks at line breaks that are
+// parsed in parallel. Returns false, with a message, if a face does not
+// parse or refers to a vertex that does not exist.
+bool parseObj(const char *data, size_t size, const std::string &filename, ObjGeometry &geometry);
+
+#endif // OBJ_PARSER_H
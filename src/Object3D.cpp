@@ -4,13 +4,12 @@
 #include "quartic.cpp"
 #include "Sampler.h"
 #include <cmath>
-#include <random>
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
 #endif
 
-bool Sphere::intersect(const Ray &r, float tmin, Hit &h) const {
+bool Sphere::hitDistance(const Ray &r, float tmin, float tmax, float &t) const {
     // Locate intersection point ( 2 pts )
     const Vector3f &rayOrigin = r.getOrigin();
     const Vector3f &dir = r.getDirection();
@@ -37,7 +36,7 @@ bool Sphere::intersect(const Ray &r, float tmin, Hit &h) const {
     }
 
     // The two intersections are at the camera front.
-    float t = 10000;
+    t = 10000;
     if (tminus > tmin) {
         t = tminus;
     }
@@ -47,23 +46,34 @@ bool Sphere::intersect(const Ray &r, float tmin, Hit &h) const {
         t = tplus;
     }
 
-    if (t < h.getT()) {
+    return t < tmax;
+}
+
+bool Sphere::intersect(const Ray &r, float tmin, Hit &h) const {
+    float t;
+    if (hitDistance(r, tmin, h.getT(), t)) {
         Vector3f normal = r.pointAtParameter(t) - _center;
         normal = normal.normalized();
         h.set(t, this->material, normal);
         return true;
     }
-    // END STARTER
     return false;
 }
 
-const Ray Sphere::sample() {
-    std::default_random_engine generator(rand());
-    std::uniform_real_distribution<float> theta_dist(0., 2 * M_PI);
-    std::uniform_real_distribution<float> cosphi_dist(-1., 1.);
+bool Sphere::occluded(const Ray &r, float tmin, float tmax) const {
+    float t;
+    return hitDistance(r, tmin, tmax, t);
+}
+
+bool Sphere::getBounds(Box &box) const {
+    box = Box(_center - Vector3f(_radius), _center + Vector3f(_radius));
+    return true;
+}
 
-    float theta = theta_dist(generator);
-    float cosphi = cosphi_dist(generator);
+const Ray Sphere::sample(SampleGenerator &gen) {
+    Vector2f u = gen.get2D();
+    float theta = 2 * M_PI * u[0];
+    float cosphi = 2 * u[1] - 1;
     float factor = sqrt(1 - cosphi * cosphi);
 
     Vector3f dir(factor * cos(theta),
@@ -83,14 +93,29 @@ int Group::getGroupSize() const {
     return (int) m_members.size();
 }
 
+void Group::build() {
+    m_bvh.build(m_members);
+}
+
 bool Group::intersect(const Ray &r, float tmin, Hit &h) const {
-    bool hit = false;
+    return m_bvh.intersect(r, tmin, h);
+}
+
+bool Group::occluded(const Ray &r, float tmin, float tmax) const {
+    return m_bvh.occluded(r, tmin, tmax);
+}
+
+bool Group::getBounds(Box &box) const {
+    if (m_bvh.hasUnbounded()) {
+        return false;
+    }
+    box = Box();
     for (Object3D *o : m_members) {
-        if (o->intersect(r, tmin, h)) {
-            hit = true;
-        }
+        Box b;
+        o->getBounds(b);
+        box.extend(b);
     }
-    return hit;
+    return !m_members.empty();
 }
 
 
@@ -103,6 +128,11 @@ bool Plane::intersect(const Ray &r, float tmin, Hit &h) const {
     return false;
 }
 
+bool Plane::occluded(const Ray &r, float tmin, float tmax) const {
+    float t = (_d - Vector3f::dot(r.getOrigin(), _normal)) / Vector3f::dot(r.getDirection(), _normal);
+    return (t > tmin) && (t < tmax);
+}
+
 bool Area::intersect(const Ray &r, float tmin, Hit &h) const {
     // See if the ray intersects the plane containing the rectangle.
     float t = Vector3f::dot(_corner - r.getOrigin(), _normal) / Vector3f::dot(r.getDirection(), _normal);
@@ -127,32 +157,39 @@ bool Area::intersect(const Ray &r, float tmin, Hit &h) const {
     return false;
 }
 
-const Ray Area::sample() {
+bool Area::getBounds(Box &box) const {
+    // intersect() accepts points up to one side length either way of the
+    // corner, and a small distance off the plane.
+    box = Box();
+    for (int i = -1; i <= 1; i += 2) {
+        for (int j = -1; j <= 1; j += 2) {
+            box.extend(_corner + (float) i * _sideOne + (float) j * _sideTwo);
+        }
+    }
+    Vector3f pad(0.01f * (_sideOne.abs() + _sideTwo.abs()));
+    box.mn -= pad;
+    box.mx += pad;
+    return true;
+}
+
+const Ray Area::sample(SampleGenerator &gen) {
     // First, select a random point on the area.
-    // Create generators for the sampling and get random lengths.
-    std::default_random_engine generator(rand());
-    std::uniform_real_distribution<float> sideOneDist(0., _sideOne.abs());
-    std::uniform_real_distribution<float> sideTwoDist(0., _sideTwo.abs());
-    float sideOneScale = sideOneDist(generator);
-    float sideTwoScale = sideTwoDist(generator);
+    Vector2f u = gen.get2D();
+    float sideOneScale = u[0] * _sideOne.abs();
+    float sideTwoScale = u[1] * _sideTwo.abs();
 
     // Fetch the random point and use a cosine weighted sampler (first two args don't matter).
     Vector3f source = _corner + sideOneScale * _sideOne.normalized() + sideTwoScale * _sideTwo.normalized();
     Hit cosineWeightedHit;
     cosineWeightedHit.set(0, this->material, _normal);
-    Sampler *sampler = new cosineWeightedHemisphere;
-    return Ray(source, sampler->sample(Ray(source, _normal), cosineWeightedHit).normalized());
+    cosineWeightedHemisphere sampler;
+    return Ray(source, sampler.sample(Ray(source, _normal), cosineWeightedHit, gen).normalized());
 }
 
 bool Triangle::intersect(const Ray &r, float tmin, Hit &h) const {
-    Matrix3f A(_v[0] - _v[1], _v[0] - _v[2], r.getDirection(), true);
-    Vector3f b = _v[0] - r.getOrigin();
-    Vector3f x = A.inverse() * b;
-    float beta = x[0];
-    float gamma = x[1];
-    float t = x[2];
-
-    if ((beta > 0) && (gamma > 0) && (beta + gamma < 1) && (t > tmin) && (t < h.getT())) {
+    float t, beta, gamma;
+    if (intersect(r.getOrigin(), r.getDirection(), _v[0], _v[1] - _v[0], _v[2] - _v[0],
+                  tmin, h.getT(), t, beta, gamma)) {
         Vector3f normal = (1 - beta - gamma) * _normals[0] + beta * _normals[1] + gamma * _normals[2];
         normal.normalize();
         h.set(t, this->material, normal);
@@ -162,8 +199,22 @@ bool Triangle::intersect(const Ray &r, float tmin, Hit &h) const {
     return false;
 }
 
+bool Triangle::occluded(const Ray &r, float tmin, float tmax) const {
+    float t, beta, gamma;
+    return intersect(r.getOrigin(), r.getDirection(), _v[0], _v[1] - _v[0], _v[2] - _v[0],
+                     tmin, tmax, t, beta, gamma);
+}
 
-bool Torus::intersect(const Ray &r, float tmin, Hit &h) const {
+bool Triangle::getBounds(Box &box) const {
+    box = Box();
+    for (int i = 0; i < 3; i++) {
+        box.extend(_v[i]);
+    }
+    return true;
+}
+
+
+bool Torus::hitDistance(const Ray &r, float tmin, float tmax, float &t) const {
     // method adapted from https://github.com/sasamil/Quartic
     // and http://www.cosinekitty.com/raytrace/chapter13_torus.html
     Vector3f ray_dir = r.getDirection();
@@ -189,7 +240,7 @@ bool Torus::intersect(const Ray &r, float tmin, Hit &h) const {
 
     // find closest solution
     std::complex<double> solution;
-    float t_min = h.getT();
+    float t_min = tmax;
     float t_guess;
     float imag_eps = 0.;
     for (int i = 0; i < 4; i++) {
@@ -206,8 +257,14 @@ bool Torus::intersect(const Ray &r, float tmin, Hit &h) const {
         }
     }
 
+    t = t_min;
+    return t_min < tmax;
+}
+
+bool Torus::intersect(const Ray &r, float tmin, Hit &h) const {
     // check that it is the closest hit so far
-    if (t_min < h.getT()) {
+    float t_min;
+    if (hitDistance(r, tmin, h.getT(), t_min)) {
         Vector3f point = r.pointAtParameter(t_min);
 
         float alpha = _R / point.xz().abs();
@@ -221,6 +278,18 @@ bool Torus::intersect(const Ray &r, float tmin, Hit &h) const {
     return false;
 }
 
+bool Torus::occluded(const Ray &r, float tmin, float tmax) const {
+    float t;
+    return hitDistance(r, tmin, tmax, t);
+}
+
+bool Torus::getBounds(Box &box) const {
+    // The torus lies in the xz-plane around the y axis.
+    float outer = _R + _r;
+    box = Box(-outer, -_r, -outer, outer, _r, outer);
+    return true;
+}
+
 
 bool Transform::intersect(const Ray &r, float tmin, Hit &h) const {
     Ray new_r(VecUtils::transformPoint(_m_inverse, r.getOrigin()),
@@ -231,4 +300,27 @@ bool Transform::intersect(const Ray &r, float tmin, Hit &h) const {
         h.normal = VecUtils::transformDirection(_m_inverse.transposed(), h.normal).normalized();
     }
     return hit;
-}
\ No newline at end of file
+}
+
+bool Transform::occluded(const Ray &r, float tmin, float tmax) const {
+    Ray new_r(VecUtils::transformPoint(_m_inverse, r.getOrigin()),
+              VecUtils::transformDirection(_m_inverse, r.getDirection()));
+    return _object->occluded(new_r, tmin, tmax);
+}
+
+bool Transform::getBounds(Box &box) const {
+    Box local;
+    if (!_object->getBounds(local)) {
+        return false;
+    }
+
+    // Bound the transformed corners of the object's own box.
+    box = Box();
+    for (int corner = 0; corner < 8; corner++) {
+        Vector3f p((corner & 4) ? local.mx[0] : local.mn[0],
+                   (corner & 2) ? local.mx[1] : local.mn[1],
+                   (corner & 1) ? local.mx[2] : local.mn[2]);
+        box.extend(VecUtils::transformPoint(_m, p));
+    }
+    return true;
+}
@@ -1,8 +1,11 @@
 #ifndef OBJECT3D_H
 #define OBJECT3D_H
 
+#include "Box.h"
+#include "BVH.h"
 #include "Ray.h"
 #include "Material.h"
+#include "SampleGenerator.h"
 
 #include <string>
 
@@ -28,7 +31,20 @@ public:
 
     virtual bool intersect(const Ray &r, float tmin, Hit &h) const = 0;
 
-    virtual const Ray sample() {
+    // True if anything lies along the ray with tmin < t < tmax. Used for
+    // visibility tests, so it may stop at the first hit and fills in nothing.
+    virtual bool occluded(const Ray &r, float tmin, float tmax) const {
+        Hit h(tmax, NULL, Vector3f());
+        return intersect(r, tmin, h);
+    }
+
+    // World-space bounds of the object. Returns false if it is unbounded.
+    virtual bool getBounds(Box &box) const {
+        return false;
+    }
+
+    // Draws an emission ray from the surface, for lights.
+    virtual const Ray sample(SampleGenerator &gen) {
         return Ray(Vector3f(0), Vector3f(0));
     }
 
@@ -57,9 +73,16 @@ public:
 
     virtual bool intersect(const Ray &r, float tmin, Hit &h) const override;
 
-    virtual const Ray sample() override;
+    virtual bool occluded(const Ray &r, float tmin, float tmax) const override;
+
+    virtual bool getBounds(Box &box) const override;
+
+    virtual const Ray sample(SampleGenerator &gen) override;
 
 private:
+    // Distance to the surface along the ray, if it is less than tmax.
+    bool hitDistance(const Ray &r, float tmin, float tmax, float &t) const;
+
     Vector3f _center;
     float _radius;
 };
@@ -71,14 +94,22 @@ public:
     // Return true if intersection found
     virtual bool intersect(const Ray &r, float tmin, Hit &h) const override;
 
+    virtual bool occluded(const Ray &r, float tmin, float tmax) const override;
+
+    virtual bool getBounds(Box &box) const override;
+
     // Add object to group
     void addObject(Object3D *obj);
 
+    // Builds the BVH over the members; call once all are added.
+    void build();
+
     // Return number of objects in group
     int getGroupSize() const;
 
 private:
     std::vector<Object3D *> m_members;
+    BVH m_bvh;
 };
 
 class Plane : public Object3D {
@@ -95,6 +126,8 @@ public:
 
     virtual bool intersect(const Ray &r, float tmin, Hit &h) const override;
 
+    virtual bool occluded(const Ray &r, float tmin, float tmax) const override;
+
 private:
     Vector3f _normal;
     float _d;
@@ -118,7 +151,9 @@ public:
 
     virtual bool intersect(const Ray &r, float tmin, Hit &h) const override;
 
-    virtual const Ray sample() override;
+    virtual bool getBounds(Box &box) const override;
+
+    virtual const Ray sample(SampleGenerator &gen) override;
 
 private:
     Vector3f _corner;
@@ -150,6 +185,39 @@ public:
 
     virtual bool intersect(const Ray &ray, float tmin, Hit &hit) const override;
 
+    virtual bool occluded(const Ray &r, float tmin, float tmax) const override;
+
+    virtual bool getBounds(Box &box) const override;
+
+    // Moller-Trumbore test against the triangle v0, v0 + e1, v0 + e2. On a hit
+    // strictly inside the triangle with tmin < t < tmax, returns true with the
+    // distance and the barycentric weights of the second and third vertices.
+    static bool intersect(const Vector3f &origin, const Vector3f &dir,
+                          const Vector3f &v0, const Vector3f &e1, const Vector3f &e2,
+                          float tmin, float tmax, float &t, float &beta, float &gamma) {
+        Vector3f p = Vector3f::cross(dir, e2);
+        float det = Vector3f::dot(e1, p);
+        if (det == 0) {
+            return false;
+        }
+        float invDet = 1 / det;
+
+        Vector3f s = origin - v0;
+        beta = Vector3f::dot(s, p) * invDet;
+        if (!(beta > 0 && beta < 1)) {
+            return false;
+        }
+
+        Vector3f q = Vector3f::cross(s, e1);
+        gamma = Vector3f::dot(dir, q) * invDet;
+        if (!(gamma > 0 && beta + gamma < 1)) {
+            return false;
+        }
+
+        t = Vector3f::dot(e2, q) * invDet;
+        return t > tmin && t < tmax;
+    }
+
     const Vector3f &getVertex(int index) const {
         assert(index < 3);
         return _v[index];
@@ -179,7 +247,14 @@ public:
 
     virtual bool intersect(const Ray &ray, float tmin, Hit &hit) const override;
 
+    virtual bool occluded(const Ray &r, float tmin, float tmax) const override;
+
+    virtual bool getBounds(Box &box) const override;
+
 private:
+    // Closest real root of the quartic with tmin < t < tmax.
+    bool hitDistance(const Ray &r, float tmin, float tmax, float &t) const;
+
     float _R;
     float _r;
 };
@@ -194,6 +269,10 @@ public:
 
     bool intersect(const Ray &r, float tmin, Hit &h) const override;
 
+    bool occluded(const Ray &r, float tmin, float tmax) const override;
+
+    bool getBounds(Box &box) const override;
+
 private:
     Object3D *_object;  // un-transformed object
     Matrix4f _m;
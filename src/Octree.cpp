@@ -1,6 +1,10 @@
+#include "Mesh.h"
+
+// The octree is only built into meshes with MESH_USE_OCTREE.
+#if MESH_USE_OCTREE
+
 #include "Ray.h"
 #include "Vector3f.h"
-#include "Mesh.h"
 #include "Octree.h"
 
 #include <vector>
@@ -42,19 +46,17 @@ inside(const Box &a, const Box &b) {
 ///@brief bounding box for a triangle
 Box
 trigBox(int t, const Mesh &m) {
-    const auto &tri = m.getTriangles();
-
     Box b;
-    b.mn = tri[t].getVertex(0);
-    b.mx = tri[t].getVertex(0);
+    b.mn = m.getVertex(t, 0);
+    b.mx = m.getVertex(t, 0);
 
     for (int ii = 1; ii < 3; ii++) {
         for (int dim = 0; dim < 3; dim++) {
-            if (b.mn[dim] > tri[t].getVertex(ii)[dim]) {
-                b.mn[dim] = tri[t].getVertex(ii)[dim];
+            if (b.mn[dim] > m.getVertex(t, ii)[dim]) {
+                b.mn[dim] = m.getVertex(t, ii)[dim];
             }
-            if (b.mx[dim] < tri[t].getVertex(ii)[dim]) {
-                b.mx[dim] = tri[t].getVertex(ii)[dim];
+            if (b.mx[dim] < m.getVertex(t, ii)[dim]) {
+                b.mx[dim] = m.getVertex(t, ii)[dim];
             }
         }
     }
@@ -62,23 +64,26 @@ trigBox(int t, const Mesh &m) {
 }
 
 ///@brief pbox parent's box
-void
-Octree::buildNode(OctNode *parent,
-                  const Box &pbox,
+OctNode
+Octree::buildNode(const Box &pbox,
                   const std::vector<int> &trigs,
                   const Mesh &m,
                   int level) {
+    OctNode node;
     if (trigs.size() <= Octree::max_trig || level > maxLevel) {
-        parent->obj = trigs;
-        return;
+        node.offset = (uint32_t) trigIndices.size();
+        node.count = (uint32_t) trigs.size();
+        trigIndices.insert(trigIndices.end(), trigs.begin(), trigs.end());
+        return node;
     }
 
     level++;
 
-    // Initialize 8 children
-    for (int ii = 0; ii < 8; ii++) {
-        parent->child[ii] = new OctNode();
-    }
+    // Reserve a group of 8 children. Children are filled in by index, since
+    // building them grows the array.
+    node.offset = (uint32_t) nodes.size();
+    node.count = OctNode::interior;
+    nodes.resize(nodes.size() + 8);
 
     const Vector3f &mn = pbox.mn;
     const Vector3f &mx = pbox.mx;
@@ -103,24 +108,25 @@ Octree::buildNode(OctNode *parent,
                 childTrigs.push_back(trigIdx);
             }
         }
-        buildNode(parent->child[ii], cBox[ii], childTrigs, m, level);
+        OctNode child = buildNode(cBox[ii], childTrigs, m, level);
+        nodes[node.offset + ii] = child;
     }
+    return node;
 }
 
 void
-Octree::build(Mesh *m) {
+Octree::build(const Mesh *m) {
     mesh = m;
 
-    const auto &tri = mesh->getTriangles();
-    assert(!tri.empty());
+    int n_trigs = mesh->getNumTriangles();
+    assert(n_trigs > 0);
 
     // compute bounding box for m
-    box.mn = tri[0].getVertex(0);
-    box.mx = tri[0].getVertex(0);
-    for (unsigned int ii = 0; ii < tri.size(); ii++) {
-        const auto &t = tri[ii];
+    box.mn = mesh->getVertex(0, 0);
+    box.mx = mesh->getVertex(0, 0);
+    for (int ii = 0; ii < n_trigs; ii++) {
         for (int vi = 0; vi < 3; ++vi) {
-            const auto &v = t.getVertex(vi);
+            const auto &v = mesh->getVertex(ii, vi);
             for (int dim = 0; dim < 3; dim++) {
                 if (box.mn[dim] > v[dim]) {
                     box.mn[dim] = v[dim];
@@ -132,14 +138,18 @@ Octree::build(Mesh *m) {
         }
     }
 
-    std::vector<int> trigs(tri.size());
+    std::vector<int> trigs(n_trigs);
     for (unsigned int ii = 0; ii < trigs.size(); ii++) {
         trigs[ii] = ii;
     }
-    buildNode(&root, box, trigs, *mesh, 0);
+    nodes.clear();
+    trigIndices.clear();
+    root = buildNode(box, trigs, *mesh, 0);
+    nodes.shrink_to_fit();
+    trigIndices.shrink_to_fit();
 }
 
-int
+static int
 first_node(float tx0, float ty0, float tz0,
            float txm, float tym, float tzm) {
     int bits = 0;
@@ -174,7 +184,7 @@ first_node(float tx0, float ty0, float tz0,
     return bits;
 }
 
-int
+static int
 new_node(float txm, int x,
          float tym, int y,
          float tzm, int z) {
@@ -197,8 +207,8 @@ Octree::proc_subtree(float tx0,
                      float tx1,
                      float ty1,
                      float tz1,
-                     OctNode *node,
-                     const Ray &ray) {
+                     const OctNode *node,
+                     OctreeQuery &query) const {
     bool intersected = false;
 
     if (tx1 < 0 || ty1 < 0 || tz1 < 0) {
@@ -207,9 +217,12 @@ Octree::proc_subtree(float tx0,
 
     if (node->isTerm()) {
         //loop over things
-        for (size_t ii = 0; ii < node->obj.size(); ii++) {
-            bool result = mesh->intersectTrig(node->obj[ii], ray);
+        for (uint32_t ii = 0; ii < node->count; ii++) {
+            bool result = mesh->intersectTrig(trigIndices[node->offset + ii], query);
             intersected = intersected || result;
+            if (intersected && query.any_hit) {
+                break;
+            }
         }
         return intersected;
     }
@@ -221,83 +234,83 @@ Octree::proc_subtree(float tx0,
     do {
         switch (currNode) {
             case 0: {
-                bool result = proc_subtree(tx0, ty0, tz0, txm, tym, tzm, node->child[aa], ray);
+                bool result = proc_subtree(tx0, ty0, tz0, txm, tym, tzm, child(node, query.aa), query);
                 intersected |= result;
                 currNode = new_node(txm, 4, tym, 2, tzm, 1);
             }
                 break;
             case 1: {
-                bool result = proc_subtree(tx0, ty0, tzm, txm, tym, tz1, node->child[1 ^ aa], ray);
+                bool result = proc_subtree(tx0, ty0, tzm, txm, tym, tz1, child(node, 1 ^ query.aa), query);
                 intersected |= result;
                 currNode = new_node(txm, 5, tym, 3, tz1, 8);
             }
                 break;
             case 2: {
-                bool result = proc_subtree(tx0, tym, tz0, txm, ty1, tzm, node->child[2 ^ aa], ray);
+                bool result = proc_subtree(tx0, tym, tz0, txm, ty1, tzm, child(node, 2 ^ query.aa), query);
                 intersected |= result;
                 currNode = new_node(txm, 6, ty1, 8, tzm, 3);
             }
                 break;
             case 3: {
-                bool result = proc_subtree(tx0, tym, tzm, txm, ty1, tz1, node->child[3 ^ aa], ray);
+                bool result = proc_subtree(tx0, tym, tzm, txm, ty1, tz1, child(node, 3 ^ query.aa), query);
                 intersected |= result;
                 currNode = new_node(txm, 7, ty1, 8, tz1, 8);
             }
                 break;
             case 4: {
-                bool result = proc_subtree(txm, ty0, tz0, tx1, tym, tzm, node->child[4 ^ aa], ray);
+                bool result = proc_subtree(txm, ty0, tz0, tx1, tym, tzm, child(node, 4 ^ query.aa), query);
                 intersected |= result;
                 currNode = new_node(tx1, 8, tym, 6, tzm, 5);
             }
                 break;
             case 5: {
-                bool result = proc_subtree(txm, ty0, tzm, tx1, tym, tz1, node->child[5 ^ aa], ray);
+                bool result = proc_subtree(txm, ty0, tzm, tx1, tym, tz1, child(node, 5 ^ query.aa), query);
                 intersected |= result;
                 currNode = new_node(tx1, 8, tym, 7, tz1, 8);
             }
                 break;
             case 6: {
-                bool result = proc_subtree(txm, tym, tz0, tx1, ty1, tzm, node->child[6 ^ aa], ray);
+                bool result = proc_subtree(txm, tym, tz0, tx1, ty1, tzm, child(node, 6 ^ query.aa), query);
                 intersected |= result;
                 currNode = new_node(tx1, 8, ty1, 8, tzm, 7);
             }
                 break;
             case 7: {
-                bool result = proc_subtree(txm, tym, tzm, tx1, ty1, tz1, node->child[7 ^ aa], ray);
+                bool result = proc_subtree(txm, tym, tzm, tx1, ty1, tz1, child(node, 7 ^ query.aa), query);
                 intersected |= result;
                 currNode = 8;
             }
                 break;
         }
-    } while (currNode < 8);
+    } while (currNode < 8 && !(intersected && query.any_hit));
 
     return intersected;
 }
 
 bool
-Octree::intersect(const Ray &ray) {
+Octree::intersect(OctreeQuery &query) const {
+    const Ray &ray = query.ray;
     Vector3f rd = ray.getDirection();
 
     //assumes rd normalized
     rd.normalize();
     Vector3f ro = ray.getOrigin();
 
-    aa = 0;
     Vector3f size = box.mx + box.mn;
     if (rd[0] < 0.0f) {
         ro[0] = size[0] - ro[0];
         rd[0] = -rd[0];
-        aa |= 4;
+        query.aa |= 4;
     }
     if (rd[1] < 0.0f) {
         ro[1] = size[1] - ro[1];
         rd[1] = -rd[1];
-        aa |= 2;
+        query.aa |= 2;
     }
     if (rd[2] < 0.0f) {
         ro[2] = size[2] - ro[2];
         rd[2] = -rd[2];
-        aa |= 1;
+        query.aa |= 1;
     }
 
 #if 0
@@ -318,8 +331,10 @@ Octree::intersect(const Ray &ray) {
     float tz1 = (box.mx[2] - ro[2]) * divz;
 
     if (std::max(std::max(tx0, ty0), tz0) <= std::min(std::min(tx1, ty1), tz1)) {
-        return proc_subtree(tx0, ty0, tz0, tx1, ty1, tz1, &root, ray);
+        return proc_subtree(tx0, ty0, tz0, tx1, ty1, tz1, &root, query);
     } else {
         return false;
     }
 }
+
+#endif // MESH_USE_OCTREE
@@ -1,44 +1,64 @@
 #ifndef OCTREE_HPP
 #define OCTREE_HPP
 
-class Mesh;
-
-struct Box {
-    Vector3f mn, mx;
-
-    Box() {}
+#include "AlignedAllocator.h"
+#include "Box.h"
 
-    Box(const Vector3f &a, const Vector3f &b) :
-            mn(a),
-            mx(b) {}
+#include <cstdint>
+#include <vector>
 
-    Box(float mnx, float mny, float mnz,
-        float mxx, float mxy, float mxz) :
-            mn(Vector3f(mnx, mny, mnz)),
-            mx(Vector3f(mxx, mxy, mxz)) {}
-};
+class Mesh;
 
+// Octree node packed into 8 bytes. The eight children of a node are stored
+// next to each other, so a sibling group fills exactly one cache line.
 struct OctNode {
-    OctNode *child[8];
+    static const uint32_t interior = 0xffffffff;
 
-    OctNode() {
-        for (int i = 0; i < 8; ++i) {
-            child[i] = nullptr;
-        }
-    }
-
-    ~OctNode() {
-        for (int i = 0; i < 8; ++i) {
-            delete child[i];
-        }
-    }
+    OctNode() :
+            offset(0),
+            count(0) {}
 
     ///@brief is this terminal
-    bool isTerm() {
-        return child[0] == nullptr;
+    bool isTerm() const {
+        return count != interior;
     }
 
-    std::vector<int> obj;
+    // Interior nodes: index of the first of the eight children.
+    // Leaves: index of the first entry in the shared triangle index array.
+    uint32_t offset;
+    // Number of triangles in a leaf, or `interior`.
+    uint32_t count;
+};
+
+static_assert(sizeof(OctNode) * 8 == 64, "a sibling group should fill one cache line");
+
+// Traversal state for a single ray query. It lives on the caller's stack and
+// is threaded through the recursion, so any number of threads can traverse
+// the same octree at once.
+struct OctreeQuery {
+    OctreeQuery(const Ray &r, float tm, Hit &h) :
+            ray(r),
+            tmin(tm),
+            hit(h),
+            aa(0),
+            any_hit(false),
+            trig(-1),
+            beta(0),
+            gamma(0) {}
+
+    const Ray &ray;
+    float tmin;
+    // Only the distance is updated during traversal; the rest of the hit is
+    // filled in once the closest triangle is known.
+    Hit &hit;
+    // Mirror bits for the negative direction components.
+    uint8_t aa;
+    // Stop at the first triangle hit rather than the closest.
+    bool any_hit;
+    // Closest triangle so far and its barycentric coordinates.
+    int trig;
+    float beta;
+    float gamma;
 };
 
 class Octree {
@@ -47,30 +67,53 @@ public:
             maxLevel(level) {
     }
 
-    void build(Mesh *m);
+    void build(const Mesh *m);
 
-    bool intersect(const Ray &ray);
+    bool intersect(OctreeQuery &query) const;
+
+    const Box &getBox() const {
+        return box;
+    }
+
+    // Bytes held by the node and triangle index arrays.
+    size_t memoryUsage() const {
+        return sizeof(OctNode) * (nodes.capacity() + 1) + sizeof(uint32_t) * trigIndices.capacity();
+    }
+
+    size_t getNumNodes() const {
+        return nodes.size() + 1;
+    }
+
+    size_t getNumTrigRefs() const {
+        return trigIndices.size();
+    }
 
 private:
-    void buildNode(OctNode *parent,
-                   const Box &pbox,
-                   const std::vector<int> &trigs,
-                   const Mesh &m,
-                   int level);
+    OctNode buildNode(const Box &pbox,
+                      const std::vector<int> &trigs,
+                      const Mesh &m,
+                      int level);
+
+    const OctNode *child(const OctNode *node, int i) const {
+        return &nodes[node->offset + i];
+    }
 
     bool proc_subtree(float tx0, float ty0, float tz0,
                       float tx1, float ty1, float tz1,
-                      OctNode *node, const Ray &r);
+                      const OctNode *node, OctreeQuery &query) const;
 
     // if a node contains more than 7 triangles and it 
     // hasn't reached the max level yet, split
     static const int max_trig = 7;
 
     int maxLevel;
-    Mesh *mesh;
+    const Mesh *mesh;
     Box box;
     OctNode root;
-    uint8_t aa;
+    // Every node below the root, in groups of eight siblings.
+    std::vector<OctNode, AlignedAllocator<OctNode>> nodes;
+    // Triangle indices of all leaves, back to back.
+    std::vector<uint32_t> trigIndices;
 };
 
 #endif
@@ -0,0 +1,33 @@
+#ifndef PATH_VERTEX_H
+#define PATH_VERTEX_H
+
+#include "Vector3f.h"
+
+#include <cstdint>
+
+// One vertex of an eye or light subpath. Eye vertices are the surface hits
+// along the camera ray's path; light vertices start with the point sampled
+// on the light, followed by the hits along its path.
+struct PathVertex {
+    Vector3f position;
+    // Surface normal, or zero for the point on the light.
+    Vector3f normal;
+    // Direction of the ray that reached this vertex.
+    Vector3f wi;
+    // Product of bsdf / pdf over the scattering events before this vertex.
+    Vector3f throughput;
+    // Solid angle density of the direction that reached this vertex, as
+    // sampled at the previous vertex.
+    float pdf_fwd;
+    // Density of sampling the way back to the previous vertex from here,
+    // given the direction the path leaves in. Zero at the end of a subpath.
+    float pdf_rev;
+    // Index into the scene's materials.
+    uint16_t material;
+    // The direction leaving this vertex came from a delta distribution.
+    bool delta;
+};
+
+static_assert(sizeof(PathVertex) == 60, "path vertices should stay tightly packed");
+
+#endif // PATH_VERTEX_H
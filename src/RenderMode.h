@@ -0,0 +1,32 @@
+#ifndef RENDER_MODE_H
+#define RENDER_MODE_H
+
+#include <string>
+
+// How the image plane is sampled.
+enum class RenderMode {
+    // Fixed number of path samples per pixel.
+    Bdpt,
+    // Primary sample space Metropolis chains over the same path samples.
+    Pssmlt,
+    // Metropolis chains that also choose which connection of a sample to
+    // evaluate.
+    Mmlt
+};
+
+// Parses "bdpt", "pssmlt" or "mmlt". Returns false if unknown.
+inline bool
+renderModeFromName(const std::string &name, RenderMode &mode) {
+    if (name == "bdpt") {
+        mode = RenderMode::Bdpt;
+    } else if (name == "pssmlt") {
+        mode = RenderMode::Pssmlt;
+    } else if (name == "mmlt") {
+        mode = RenderMode::Mmlt;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+#endif // RENDER_MODE_H
@@ -2,12 +2,21 @@
 
 #include "ArgParser.h"
 #include "Camera.h"
+#include "Checkpoint.h"
 #include "Image.h"
+#include "PathVertex.h"
 #include "Ray.h"
+#include "SampleGenerator.h"
 #include "iterator.h"
+#include "thread_pool.h"
+#include "tiles.h"
 #include "VecUtils.h"
 
-#include <random>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <limits>
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
@@ -17,194 +26,852 @@
 // Beta value for MIS. The value below is recommended by E. Veach.
 const int MIS_BETA = 2.f;
 
+// Longest subpath kept, in vertices. Longer draws are cut short.
+const int max_path_vertices = 1024;
+
+// Samples per block of the pixel estimate. Blocks are summed separately and
+// then in order, which fixes the result whatever the thread count.
+const unsigned sample_grain = 4;
+
+// Metropolis mutations: standard deviation of a small step in each primary
+// sample dimension, and the chance of a large step instead.
+const float mutation_sigma = 0.01f;
+const float large_step_probability = 0.3f;
+
+// Metropolis chains started per thread when -chains is not given.
+const int default_chains_per_thread = 4;
+
+// Ratio between the temperatures of neighbouring Metropolis replicas.
+const float temperature_ratio = 2.f;
+
+// Samples per pixel in a pass when a time budget, an error target or
+// adaptive sampling is given without -pass.
+const int default_pass_size = 16;
+
+// Adaptive sampling: uniform passes before any tile may retire, and the
+// most passes' worth of samples a tile far from converged gets at once.
+const int uniform_passes = 2;
+const int max_adaptive_boost = 4;
+
 Renderer::Renderer(const ArgParser &args) :
         _args(args),
-        _scene(args.input_file) {
+        _ownedScene(new SceneParser(args.input_file)),
+        _scene(*_ownedScene),
+        _camera(NULL),
+        _pattern(SamplePattern::Random),
+        _mode(RenderMode::Bdpt) {
+    init();
 }
 
-Vector3f Renderer::estimatePixel(const Ray &ray, float tmin, float length, int iters) {
-    // Average over multiple iterations.
-    Vector3f color;
-    parallel_for(iters, [&](int start, int end) {
-        for (int i = start; i < end; i++) {
-            // 1. Choose a light
-            std::default_random_engine generator(rand());
-            std::uniform_int_distribution<int> uniform(0, _scene.lights.size() - 1);
-            Object3D *light = _scene.lights[uniform(generator)];
+Renderer::Renderer(const ArgParser &args, SceneParser &scene) :
+        _args(args),
+        _scene(scene),
+        _camera(NULL),
+        _pattern(SamplePattern::Random),
+        _mode(RenderMode::Bdpt) {
+    init();
+}
 
-            float prob_path = 1;
+void Renderer::init() {
+    samplePatternFromName(_args.sampler, _pattern);
+    renderModeFromName(_args.mode, _mode);
 
-            std::vector<Ray> eye_path;
-            std::vector<Ray> light_path;
-            std::vector<Hit> eye_hits;
-            std::vector<Hit> light_hits;
+    _camera = _scene.getCamera();
+    if (_args.camera.size() == 10) {
+        const std::vector<float> &c = _args.camera;
+        _cameraOverride.reset(new PerspectiveCamera(Vector3f(c[0], c[1], c[2]), Vector3f(c[3], c[4], c[5]),
+                                                    Vector3f(c[6], c[7], c[8]), (float) (c[9] * M_PI / 180)));
+        _camera = _cameraOverride.get();
+    }
+}
 
-            choosePath(ray, light, tmin, length, prob_path, eye_path, eye_hits, light_path, light_hits);
-            Vector3f path_color = colorPath(tmin, light, eye_path, eye_hits, light_path, light_hits);
-            color += path_color;
+// Scratch space for the samples traced on one thread. Subpaths live in
+// fixed arrays that are reused from sample to sample.
+struct Renderer::PathStorage {
+    PathStorage() :
+            n_eye(0),
+            n_light(0),
+            n_splats(0) {}
+
+    PathVertex eye[max_path_vertices];
+    PathVertex light[max_path_vertices];
+    // Light vertices seen by the camera.
+    Splat splats[max_path_vertices];
+    int n_eye;
+    int n_light;
+    int n_splats;
+
+    std::unique_ptr<SampleGenerator> gen;
+    SamplePattern pattern;
+    uint32_t seed;
+
+    void clear() {
+        n_eye = 0;
+        n_light = 0;
+        n_splats = 0;
+    }
+
+    // The thread's generator, rebuilt only if the pattern or seed changes.
+    SampleGenerator &generator(SamplePattern p, uint32_t s) {
+        if (!gen || pattern != p || seed != s) {
+            gen = createSampleGenerator(p, s);
+            pattern = p;
+            seed = s;
         }
+        return *gen;
+    }
+};
+
+Renderer::PathStorage &Renderer::threadPaths() {
+    static thread_local PathStorage paths;
+    return paths;
+}
+
+Ray Renderer::pixelRay(int x, int y) const {
+    // Use PerspectiveCamera to generate a ray.
+    float ndcx = 2 * (x / (_args.width - 1.0f)) - 1.0f;
+    float ndcy = 2 * (y / (_args.height - 1.0f)) - 1.0f;
+    return _camera->generateRay(Vector2f(ndcx, ndcy));
+}
+
+void Renderer::estimatePixel(const Ray &ray, int x, int y, float tmin, float length, int first, int count,
+                             AccumulationImage &film) {
+    // Sum over multiple iterations. Each block of samples sums into its own
+    // partial, so long paths can be spread across threads.
+    Vector3f color = parallel_reduce<Vector3f>(count, sample_grain, Vector3f::ZERO, [&](int start, int end) {
+        PathStorage &paths = threadPaths();
+        SampleGenerator &gen = paths.generator(_pattern, (uint32_t) _args.seed);
+
+        Vector3f partial;
+        for (int i = start; i < end; i++) {
+            partial += traceSample(ray, x, y, first + i, tmin, length, paths, gen);
+            for (int s = 0; s < paths.n_splats; s++) {
+                film.addSplat(paths.splats[s].x, paths.splats[s].y, paths.splats[s].color);
+            }
+        }
+        return partial;
+    }, [](const Vector3f &a, const Vector3f &b) {
+        return a + b;
     }, length > 100);
-    return color / (float) iters;
+
+    // Every sample counts once toward its own pixel, wherever its weight
+    // went, so the splats from other pixels' samples stand in for the share
+    // this pixel's samples gave away.
+    film.addSample(x, y, color, (float) count);
+}
+
+bool Renderer::restoreCheckpoints(AccumulationImage &film, Checkpoint &state, std::string &error) const {
+    // Hashing the scene's files is only worth it if a checkpoint is used.
+    uint64_t key = 0;
+    bool checkpoints = !_args.checkpoint_file.empty() || !_args.resume_file.empty() || !_args.merge_files.empty();
+    if (checkpoints && !checkpointKey(_args, _scene.getSourceFiles(), key, error)) {
+        return false;
+    }
+    state.reset(key, _args.width, _args.height, _args.seed);
+    if (!_args.resume_file.empty()) {
+        Checkpoint checkpoint;
+        if (!checkpoint.load(_args.resume_file, error) || !state.merge(checkpoint, error)) {
+            return false;
+        }
+        if (checkpoint.seeds[0] != _args.seed) {
+            error = "Checkpoint '" + _args.resume_file + "' continues seed " + std::to_string(checkpoint.seeds[0]);
+            return false;
+        }
+    }
+    for (const std::string &filename : _args.merge_files) {
+        Checkpoint checkpoint;
+        if (!checkpoint.load(filename, error) || !state.merge(checkpoint, error)) {
+            error = "Could not merge '" + filename + "': " + error;
+            return false;
+        }
+    }
+    film.addFloats(state.film);
+    return true;
+}
+
+void Renderer::saveCheckpoint(const AccumulationImage &film, Checkpoint &state) const {
+    if (_args.checkpoint_file.empty()) {
+        return;
+    }
+    state.film = film.getFloats();
+    state.save(_args.checkpoint_file);
+}
+
+void Renderer::writeSnapshot(const AccumulationImage &film) const {
+    if (_args.output_file.empty()) {
+        return;
+    }
+    // Write next to the output and rename over it, so a viewer never reads
+    // a half-written image.
+    std::string partial = _args.output_file + ".part.png";
+    film.resolve().savePNG(partial);
+    if (std::rename(partial.c_str(), _args.output_file.c_str()) != 0) {
+        printf("Could not write snapshot '%s'\n", _args.output_file.c_str());
+    }
+}
+
+Vector3f Renderer::traceSample(const Ray &ray, int x, int y, int index, float tmin, float length,
+                               PathStorage &paths, SampleGenerator &gen, const Vector2f *strategySample) const {
+    // The result depends only on the seed, the pixel and the sample index.
+    gen.startSample(x, y, index);
+    paths.clear();
+
+    // 1. Choose a light
+    gen.startBlock(SampleDims::light_choice, 1);
+    Object3D *light = _scene.lights[gen.uniformInt((int) _scene.lights.size())];
+
+    choosePath(ray, light, tmin, length, paths, gen);
+    if (!strategySample) {
+        return colorPath(tmin, light, paths);
+    }
+
+    // Pick one of the eye vertices or the camera, and one light vertex.
+    int eyeChoices = paths.n_eye + 1;
+    Strategy only;
+    only.eye_end = std::min((int) ((*strategySample)[0] * eyeChoices), eyeChoices - 1);
+    only.light_end = std::min((int) ((*strategySample)[1] * paths.n_light), paths.n_light - 1);
+    float choices = (float) (eyeChoices * paths.n_light);
+
+    Vector3f color = colorPath(tmin, light, paths, &only);
+    for (int s = 0; s < paths.n_splats; s++) {
+        paths.splats[s].color = paths.splats[s].color * choices;
+    }
+    return color * choices;
 }
 
-void Renderer::tracePath(const Ray &r, float tmin, int length, float &prob_path, std::vector<Ray> &path,
-                         std::vector<Hit> &hits) const {
+float Renderer::metropolisSample(float tmin, float length, bool multiplexed, MetropolisGenerator &gen,
+                                 PathStorage &paths, std::vector<Splat> &records) const {
+    Vector2f filmSample = gen.getFilmSample();
+    int x = std::min((int) (filmSample[0] * _args.width), _args.width - 1);
+    int y = std::min((int) (filmSample[1] * _args.height), _args.height - 1);
+    Vector2f strategySample;
+    if (multiplexed) {
+        strategySample = gen.getStrategySample();
+    }
+
+    // Every state is sample 0 of its pixel; only the primary sample values
+    // change between states.
+    Vector3f color = traceSample(pixelRay(x, y), x, y, 0, tmin, length, paths, gen,
+                                 multiplexed ? &strategySample : NULL);
+
+    records.clear();
+    Splat own = {x, y, color};
+    records.push_back(own);
+    // The Metropolis target is the luminance of everything the state adds
+    // to the film.
+    float f = VecUtils::luminance(color);
+    for (int s = 0; s < paths.n_splats; s++) {
+        records.push_back(paths.splats[s]);
+        f += VecUtils::luminance(paths.splats[s].color);
+    }
+    // Rounding can leave a few colors slightly negative.
+    return std::max(f, 0.f);
+}
+
+// One replica of a Metropolis chain, targeting its luminance raised to
+// beta.
+struct Renderer::Replica {
+    std::unique_ptr<MetropolisGenerator> gen;
+    std::vector<Splat> records;
+    float f;
+    float beta;
+};
+
+void Renderer::renderMetropolis(float tmin, float length, int iters, AccumulationImage &film) {
+    int w = _args.width;
+    int h = _args.height;
+    uint32_t seed = (uint32_t) _args.seed;
+    bool multiplexed = _mode == RenderMode::Mmlt;
+
+    // Bootstrap: uniform samples estimate the normalization, the mean
+    // luminance over primary sample space, and seed the chains in
+    // proportion to their luminance. Sample k is the first state of a
+    // generator with stream k, so a chain can start from it again.
+    int n_bootstrap = _args.bootstrap > 0 ? _args.bootstrap : w * h;
+    std::vector<float> bootstrap(n_bootstrap);
+    parallel_for(n_bootstrap, [&](int start, int end) {
+        PathStorage &paths = threadPaths();
+        std::vector<Splat> records;
+        for (int k = start; k < end; k++) {
+            MetropolisGenerator gen(seed, (uint64_t) k, mutation_sigma, large_step_probability);
+            bootstrap[k] = metropolisSample(tmin, length, multiplexed, gen, paths, records);
+        }
+    });
+
+    std::vector<double> cdf(n_bootstrap + 1, 0.);
+    for (int k = 0; k < n_bootstrap; k++) {
+        cdf[k + 1] = cdf[k] + bootstrap[k];
+    }
+    double b = cdf[n_bootstrap] / n_bootstrap;
+    if (b <= 0) {
+        // No light reaches the camera.
+        return;
+    }
+
+    // Chains split the mutations of iters samples per pixel between all
+    // their replicas; only the coldest replica's count toward the image.
+    int n_levels = std::max(1, _args.temperatures);
+    int64_t n_mutations = (int64_t) iters * w * h / n_levels;
+    int n_chains = _args.chains > 0
+                   ? _args.chains
+                   : default_chains_per_thread * (int) ThreadPool::instance().concurrency();
+    n_chains = (int) std::max<int64_t>(1, std::min<int64_t>(n_chains, n_mutations));
+
+    // Each chain and its replicas live on one thread; the film is the only
+    // state the chains share.
+    parallel_for(n_chains, [&](int start, int end) {
+        PathStorage &paths = threadPaths();
+        std::vector<Splat> proposed;
+        for (int c = start; c < end; c++) {
+            Rng rng(Rng::hash(seed, (uint64_t) c), 1);
+            int64_t chain_mutations = n_mutations / n_chains + (c < n_mutations % n_chains ? 1 : 0);
+
+            // Start every replica from a bootstrap sample picked in
+            // proportion to its luminance, so the coldest begins in its
+            // stationary distribution.
+            std::vector<Replica> replicas(n_levels);
+            for (int level = 0; level < n_levels; level++) {
+                Replica &r = replicas[level];
+                double target = rng.uniform() * cdf[n_bootstrap];
+                int k = (int) (std::upper_bound(cdf.begin() + 1, cdf.end(), target) - (cdf.begin() + 1));
+                k = std::min(k, n_bootstrap - 1);
+                r.gen.reset(new MetropolisGenerator(seed, (uint64_t) k, mutation_sigma, large_step_probability));
+                r.f = metropolisSample(tmin, length, multiplexed, *r.gen, paths, r.records);
+                r.beta = std::pow(1 / temperature_ratio, (float) level);
+            }
+
+            for (int64_t m = 0; m < chain_mutations; m++) {
+                for (int level = 0; level < n_levels; level++) {
+                    Replica &r = replicas[level];
+                    r.gen->startIteration();
+                    float proposedF = metropolisSample(tmin, length, multiplexed, *r.gen, paths, proposed);
+                    float accept = 1;
+                    if (r.f > 0) {
+                        accept = std::min(1.f, std::pow(proposedF / r.f, r.beta));
+                    }
+
+                    // Record both states, weighted by their chance of being
+                    // the next one, which lowers the variance of rejected
+                    // proposals.
+                    if (level == 0) {
+                        if (r.f > 0 && accept < 1) {
+                            float scale = (float) b * (1 - accept) / r.f;
+                            for (const Splat &s : r.records) {
+                                film.addSample(s.x, s.y, s.color * scale, 0);
+                            }
+                        }
+                        if (proposedF > 0 && accept > 0) {
+                            float scale = (float) b * accept / proposedF;
+                            for (const Splat &s : proposed) {
+                                film.addSample(s.x, s.y, s.color * scale, 0);
+                            }
+                        }
+                    }
+
+                    if (rng.uniform() < accept) {
+                        r.gen->accept();
+                        std::swap(r.records, proposed);
+                        r.f = proposedF;
+                    } else {
+                        r.gen->reject();
+                    }
+                }
+
+                // Offer to exchange the states of two neighbouring levels,
+                // so states found at high temperatures reach the coldest.
+                if (n_levels > 1) {
+                    int level = rng.uniformInt(n_levels - 1);
+                    Replica &cold = replicas[level];
+                    Replica &hot = replicas[level + 1];
+                    if (cold.f > 0 && hot.f > 0 &&
+                        rng.uniform() < std::pow(hot.f / cold.f, cold.beta - hot.beta)) {
+                        std::swap(cold.gen, hot.gen);
+                        std::swap(cold.records, hot.records);
+                        std::swap(cold.f, hot.f);
+                    }
+                }
+            }
+        }
+    });
+
+    // Each mutation of a coldest replica stands for one sample of the
+    // image, so a pixel averages over its share of them.
+    float perPixel = (float) n_mutations / (w * h);
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            film.addSample(x, y, Vector3f::ZERO, perPixel);
+        }
+    }
+}
+
+int Renderer::tracePath(const Ray &r, float tmin, int length, PathVertex *vertices, int count, bool light_path,
+                        SampleGenerator &gen) const {
     assert(length >= 1);
 
     Ray ray = r;
-    path.push_back(r);
-
+    float pdf = 1;
     for (int i = 1; i < length; i++) {
         Hit h;
-        if (_scene.getGroup()->intersect(ray, tmin, h)) {
-            Vector3f o = ray.pointAtParameter(h.getT());
-            Vector3f d = _scene.sampler->sample(ray, h);
-            prob_path *= _scene.sampler->pdf(ray, d, h);
-
-            ray = Ray(o, d);
-            path.push_back(ray);
-            hits.push_back(h);
+        if (!_scene.getGroup()->intersect(ray, tmin, h)) {
+            break;
+        }
+
+        PathVertex &v = vertices[count];
+        v.position = ray.pointAtParameter(h.getT());
+        v.normal = h.getNormal();
+        v.wi = ray.getDirection();
+        v.material = (uint16_t) h.getMaterial()->getId();
+        v.pdf_rev = 0;
+        if (i == 1) {
+            // Reached straight from the camera or the light.
+            v.throughput = Vector3f(1.);
+            v.pdf_fwd = 1;
         } else {
+            const PathVertex &prev = vertices[count - 1];
+            v.throughput = prev.throughput * (shadeVertex(prev, v.wi) / pdf);
+            v.pdf_fwd = pdf;
+        }
+
+        gen.startBlock(SampleDims::bounce(i - 1, light_path), SampleDims::bounce_dims);
+        Vector3f d = _scene.sampler->sample(ray, h, gen);
+        pdf = _scene.sampler->pdf(ray, d, h);
+        v.delta = _scene.sampler->isDelta();
+        if (count > 0) {
+            Ray back(v.position, -d);
+            vertices[count - 1].pdf_rev = _scene.sampler->pdf(back, -v.wi, h);
+        }
+
+        count++;
+        // A direction the sampler could not have chosen, such as a grazing
+        // one, has no usable pdf; dividing by it would make the throughput
+        // of the rest of the path NaN.
+        if (!(pdf > 0) || !std::isfinite(pdf)) {
             break;
         }
+        ray = Ray(v.position, d);
     }
+    return count;
 }
 
-void Renderer::choosePath(const Ray &r, Object3D *light, float tmin, float length, float &prob_path,
-                          std::vector<Ray> &eye_path, std::vector<Hit> &eye_hits, std::vector<Ray> &light_path,
-                          std::vector<Hit> &light_hits) const {
-    std::default_random_engine generator(rand());
-    std::geometric_distribution<int> geometric(1. / length);
-
-    // 2. Draw light path
-    int light_length = 1 + geometric(generator);
-    float light_prob = 1;
-    tracePath(light->sample(), tmin, light_length, light_prob, light_path, light_hits);
+void Renderer::choosePath(const Ray &r, Object3D *light, float tmin, float length, PathStorage &paths,
+                          SampleGenerator &gen) const {
+    float p = 1.f / length;
+    gen.startBlock(SampleDims::path_lengths, 2);
+    int light_length = std::min(1 + gen.geometric(p), max_path_vertices);
+    int eye_length = std::min(2 + gen.geometric(p), max_path_vertices + 1);
+
+    // 2. Draw light path, starting from a point on the light.
+    gen.startBlock(SampleDims::light_emission, 4);
+    Ray emitted = light->sample(gen);
+    PathVertex &source = paths.light[0];
+    source.position = emitted.getOrigin();
+    source.normal = Vector3f::ZERO;
+    source.wi = Vector3f::ZERO;
+    source.throughput = Vector3f(1.);
+    source.pdf_fwd = 1;
+    source.pdf_rev = 0;
+    source.material = (uint16_t) light->getMaterial()->getId();
+    source.delta = false;
+    paths.n_light = tracePath(emitted, tmin, light_length, paths.light, 1, true, gen);
 
     // 3. Draw eye path
-    int eye_length = 2 + geometric(generator);
-    float eye_prob = 1;
-    tracePath(r, tmin, eye_length, eye_prob, eye_path, eye_hits);
-}
-
-void Renderer::precomputeCumulativeBSDF(const std::vector<Ray> &path,
-                                        const std::vector<Hit> &hits,
-                                        std::vector<Vector3f> &bsdf,
-                                        std::vector<float> &pdf) {
-
-    // Find each BSDF iteratively.
-    for (unsigned long i = 0; i < path.size() - 2; i++) {
-        float currentPDF = _scene.sampler->pdf(path[i], path[i + 1].getDirection(), const_cast<Hit &>(hits[i]));
-        Vector3f currentBSDF = (hits[i].getMaterial()->shade(path[i], hits[i], path[i + 1].getDirection()))
-                               / currentPDF;
-        if (i == 0) {
-            bsdf.emplace_back(currentBSDF);
-            pdf.emplace_back(pow(currentPDF, MIS_BETA));
-        } else {
-            bsdf.emplace_back(bsdf[i - 1] * currentBSDF);
-            pdf.emplace_back(pdf[i-1]*pow(currentPDF, MIS_BETA));
-        }
-        // Also multiplying by:
-        // Vector3f::dot(hit.getNormal(), outgoing);
-        // Will be good once that's added.
+    paths.n_eye = tracePath(r, tmin, eye_length, paths.eye, 0, false, gen);
+}
+
+Vector3f Renderer::shadeVertex(const PathVertex &v, const Vector3f &dir) const {
+    Material *material = _scene.getMaterial(v.material);
+    return material->shade(Ray(v.position, v.wi), Hit(0, material, v.normal), dir);
+}
+
+float Renderer::vertexPdf(const PathVertex &v, const Vector3f &in, const Vector3f &out) const {
+    Material *material = _scene.getMaterial(v.material);
+    Hit h(0, material, v.normal);
+    return _scene.sampler->pdf(Ray(v.position, in), out, h);
+}
+
+// Zero densities come from directions a vertex cannot sample; they are
+// taken as 1 so the ratios stay finite.
+static inline float
+remap0(float pdf) {
+    return pdf != 0 ? pdf : 1;
+}
+
+static inline float
+powBeta(float x) {
+    float y = 1;
+    for (int i = 0; i < MIS_BETA; i++) {
+        y *= x;
     }
+    return y;
 }
 
-Vector3f Renderer::colorPath(float tmin, Object3D *light, const std::vector<Ray> &eye_path, std::vector<Hit> &eye_hits,
-                             const std::vector<Ray> &light_path, std::vector<Hit> &light_hits) {
+// Adds vertex i to the running sum of power heuristic ratios of its subpath,
+// given its density when sampled from the other side. The strategy that
+// would connect i to i - 1 is only counted if neither scatters through a
+// delta distribution; the first eye vertex connects to the camera.
+static inline float
+accumulateRatios(float sum, float pdfOther, const PathVertex *vertices, int i) {
+    bool connectible = !vertices[i].delta && (i == 0 || !vertices[i - 1].delta);
+    return powBeta(remap0(pdfOther) / remap0(vertices[i].pdf_fwd)) * ((connectible ? 1 : 0) + sum);
+}
 
-    // First, pre-compute the BSDF and weights for each component of the paths.
-    std::vector<float> eye_pdfs, light_pdfs;
-    std::vector<Vector3f> eye_bsdf, light_bsdf;
-    if (eye_path.size() > 2) {
-        precomputeCumulativeBSDF(eye_path, eye_hits, eye_bsdf, eye_pdfs);
+float Renderer::junctionRatios(const PathVertex *vertices, int end, int first, float sumBefore, float pdfToEnd,
+                               const Vector3f &in) const {
+    if (end < first) {
+        return 0;
     }
-    if (light_path.size() > 2) {
-        precomputeCumulativeBSDF(light_path, light_hits, light_bsdf, light_pdfs);
+    float inner = 0;
+    if (end - 1 >= first) {
+        float pdf = vertexPdf(vertices[end], in, -vertices[end].wi);
+        inner = accumulateRatios(sumBefore, pdf, vertices, end - 1);
     }
+    return accumulateRatios(inner, pdfToEnd, vertices, end);
+}
+
+bool Renderer::pixelOf(const Vector3f &point, int &x, int &y) const {
+    // Inverse of the screen coordinates Render gives each pixel.
+    Vector2f screen;
+    if (!_camera->project(point, screen)) {
+        return false;
+    }
+    float fx = (screen[0] + 1) / 2 * (_args.width - 1.0f);
+    float fy = (screen[1] + 1) / 2 * (_args.height - 1.0f);
+    if (!(fx > -0.5f && fx < _args.width - 0.5f && fy > -0.5f && fy < _args.height - 0.5f)) {
+        return false;
+    }
+    x = std::min((int) std::floor(fx + 0.5f), _args.width - 1);
+    y = std::min((int) std::floor(fy + 0.5f), _args.height - 1);
+    return true;
+}
 
+Vector3f Renderer::colorPath(float tmin, Object3D *light, PathStorage &paths, const Strategy *only) const {
     // For each combination, find the intensity; average once all are found.
+    // Weights are the products of the pdfs along each subpath, raised to
+    // MIS_BETA, up to the connected vertices. Each combination then shares
+    // its weight with the other ways of splitting the same vertices into an
+    // eye and a light subpath, by the power heuristic. Vertices away from
+    // the connection contribute the same ratios to every combination, so
+    // their sums are kept as the loops advance; only the two vertices on
+    // each side of the connection are evaluated per pair. The weight is
+    // then constant work per pair, but each pair still shades both ends and
+    // traces a connector, so a sample costs n_eye * n_light of those.
     Vector3f intensity;
+    Vector3f emitted;
     float overallDensity = 0;
-    for (unsigned long i = 2; i <= eye_path.size(); i++) {
-        for (unsigned long j = 1; j <= light_path.size(); j++) {
-            intensity += colorPathCombination(tmin, light, eye_path, eye_hits, eye_bsdf, eye_pdfs, light_path,
-                                              light_hits, light_bsdf, light_pdfs, i, j, overallDensity);
+    float eyeWeight = 1;
+
+    // Ratio sums up to eye vertex e - 2 and e - 1. The point on the light
+    // never moves, since only the light samples it.
+    float eyeRatios = 0;
+    float eyeRatiosNext = 0;
+    for (int e = 0; e < paths.n_eye; e++) {
+        if (e > 0) {
+            eyeWeight = eyeWeight * powBeta(paths.eye[e].pdf_fwd);
         }
+        // Light found on the way.
+        emitted += paths.eye[e].throughput * _scene.getMaterial(paths.eye[e].material)->getLight();
+
+        float lightWeight = 1;
+        float lightRatios = 0;
+        float lightRatiosNext = 0;
+        for (int l = 0; l < paths.n_light; l++) {
+            if (l > 0) {
+                lightWeight = lightWeight * powBeta(paths.light[l].pdf_fwd);
+            }
+            bool evaluate = !only || (only->eye_end == e && only->light_end == l);
+            intensity += colorPathCombination(tmin, light, paths, e, l, eyeWeight * lightWeight, eyeRatios,
+                                              lightRatios, emitted, evaluate, overallDensity);
+            float sum = l > 0 ? accumulateRatios(lightRatiosNext, paths.light[l].pdf_rev, paths.light, l) : 0;
+            lightRatios = lightRatiosNext;
+            lightRatiosNext = sum;
+        }
+
+        float sum = accumulateRatios(eyeRatiosNext, paths.eye[e].pdf_rev, paths.eye, e);
+        eyeRatios = eyeRatiosNext;
+        eyeRatiosNext = sum;
+    }
+
+    // Light tracing: connect each light vertex to the camera.
+    float lightWeight = 1;
+    float lightRatios = 0;
+    float lightRatiosNext = 0;
+    for (int l = 0; l < paths.n_light; l++) {
+        if (l > 0) {
+            lightWeight = lightWeight * powBeta(paths.light[l].pdf_fwd);
+            bool evaluate = !only || (only->eye_end == paths.n_eye && only->light_end == l);
+            connectToCamera(tmin, light, paths, l, lightWeight, lightRatios, evaluate, overallDensity);
+        }
+        float sum = l > 0 ? accumulateRatios(lightRatiosNext, paths.light[l].pdf_rev, paths.light, l) : 0;
+        lightRatios = lightRatiosNext;
+        lightRatiosNext = sum;
+    }
+
+    if (overallDensity == 0) {
+        return Vector3f::ZERO;
+    }
+    for (int i = 0; i < paths.n_splats; i++) {
+        paths.splats[i].color = paths.splats[i].color / overallDensity;
     }
     return intensity / overallDensity;
 }
 
-Vector3f Renderer::colorPathCombination(float tmin, Object3D *light, const std::vector<Ray> &eye_path,
-                                        const std::vector<Hit> &eye_hits, const std::vector<Vector3f> &eye_bsdf,
-                                        const std::vector<float> &eye_pdfs,
-                                        const std::vector<Ray> &light_path, const std::vector<Hit> &light_hits,
-                                        const std::vector<Vector3f> &light_bsdf,
-                                        const std::vector<float> &light_pdfs, unsigned long eye_length,
-                                        unsigned long light_length, float &overallDensity) {
+Vector3f Renderer::colorPathCombination(float tmin, Object3D *light, const PathStorage &paths, int eye_end,
+                                        int light_end, float weight, float eyeRatios, float lightRatios,
+                                        const Vector3f &emitted, bool evaluate, float &overallDensity) const {
+    const PathVertex &eyeVertex = paths.eye[eye_end];
+    const PathVertex &lightVertex = paths.light[light_end];
 
     // First, create a connector between the end of the eye segment and the beginning of the light segment.
-    Ray last_eye = eye_path[eye_length - 1];
-    Ray last_light = light_path[light_length - 1];
-    Vector3f connectorDir = last_light.getOrigin() - last_eye.getOrigin();
-    Ray connector = Ray(last_eye.getOrigin(), connectorDir.normalized());
+    Vector3f connectorDir = lightVertex.position - eyeVertex.position;
+    Ray connector = Ray(eyeVertex.position, connectorDir.normalized());
+    const Vector3f &dir = connector.getDirection();
+
+    // Densities of the vertices next to the connector when sampled from the
+    // other subpath. Leaving the light itself has density 1, as for the
+    // light subpath.
+    lightRatios = light_end >= 1 ? junctionRatios(paths.light, light_end, 1, lightRatios,
+                                                  vertexPdf(eyeVertex, eyeVertex.wi, dir), dir) : 0;
+    float pdfToEye = light_end >= 1 ? vertexPdf(lightVertex, lightVertex.wi, -dir) : 1;
+    eyeRatios = junctionRatios(paths.eye, eye_end, 0, eyeRatios, pdfToEye, -dir);
+    weight = weight / (1 + lightRatios + eyeRatios);
+    if (!evaluate) {
+        overallDensity += weight;
+        return Vector3f::ZERO;
+    }
 
-    // Find an intersection with the connector and the scene.
-    Hit connector_hit;
-    _scene.getGroup()->intersect(connector, tmin, connector_hit);
+    // Check whether anything blocks the connector short of its far end.
+    bool blocked = _scene.getGroup()->occluded(connector, tmin, connectorDir.abs() - tmin);
 
     // Calculate the overall light intensity.
     // Start off with the initial emitted light, eye path, and light path.
-    Vector3f lightIntensity = light->getMaterial()->getLight();
-    float weight = 1;
-    if (eye_length >= 3) {
-        lightIntensity = lightIntensity * eye_bsdf[eye_length - 3];
-        weight = weight * eye_pdfs[eye_length - 3];
-    }
-    if (light_length >= 3) {
-        lightIntensity = lightIntensity * light_bsdf[light_length - 3];
-        weight = weight * light_pdfs[light_length - 3];
-    }
+    Vector3f lightIntensity = light->getMaterial()->getLight() * eyeVertex.throughput * lightVertex.throughput;
 
     // Terminate early if there is an intersection with the scene.
-    if (connector_hit.getT() + tmin < connectorDir.abs()) {
+    if (blocked) {
         overallDensity += weight;
         return Vector3f::ZERO;
     }
 
     // Consider the connector (the PDF of the connector is 1).
     // Add the connector's contribution to the eye path.
-    Hit lastEyeHit = eye_hits[eye_length - 2];
-    Vector3f lastEye_bsdf = lastEyeHit.getMaterial()->shade(eye_path[eye_length - 2], lastEyeHit,
-                                                            connector.getDirection());
-    float eyeDot = 1; // Vector3f::dot(lastEyeHit.getNormal(), connector.getDirection());
+    Vector3f lastEye_bsdf = shadeVertex(eyeVertex, connector.getDirection());
+    float eyeDot = 1; // Vector3f::dot(eyeVertex.normal, connector.getDirection());
     lightIntensity = lightIntensity * lastEye_bsdf * eyeDot;
 
     // Add the connector's contribution to the light path and return.
-    // In the case where the light length is 1 we can ignore this.
-    if (light_length >= 2) {
-        Hit lastLightHit = light_hits[light_length - 2];
-        Vector3f lastLight_bsdf = lastLightHit.getMaterial()->shade(light_path[light_length - 2], lastLightHit,
-                                                                    -connector.getDirection());
-        float lightDot = 1; // Vector3f::dot(lastLightHit.getNormal(), -connector.getDirection());
+    // The point on the light itself does not scatter.
+    if (light_end >= 1) {
+        Vector3f lastLight_bsdf = shadeVertex(lightVertex, -connector.getDirection());
+        float lightDot = 1; // Vector3f::dot(lightVertex.normal, -connector.getDirection());
         lightIntensity = lightIntensity * lastLight_bsdf * lightDot;
     }
 
     // Add on light found on the way
-    for (int i=0; i<eye_length-1; i++) {
-        Hit h = eye_hits[i];
-        if (h.getMaterial()->getLight() != Vector3f::ZERO) {
-            Vector3f bsdf = i > 0 ? eye_bsdf[i-1] : Vector3f(1.);
-            lightIntensity += bsdf * h.getMaterial()->getLight();
-        }
-    }
+    lightIntensity += emitted;
 
     // Record the weight, apply it, and return.
     overallDensity += weight;
     return weight*lightIntensity;
 }
 
-void Renderer::Render() {
+void Renderer::connectToCamera(float tmin, Object3D *light, PathStorage &paths, int light_end, float weight,
+                               float lightRatios, bool evaluate, float &overallDensity) const {
+    const PathVertex &lightVertex = paths.light[light_end];
+
+    // Light vertices outside the view have no pixel to land in.
+    int x, y;
+    if (!pixelOf(lightVertex.position, x, y)) {
+        return;
+    }
+    Vector3f toCamera = _camera->getCenter() - lightVertex.position;
+    Ray connector = Ray(lightVertex.position, toCamera.normalized());
+    const Vector3f &dir = connector.getDirection();
+
+    // From the eye side, the vertex would be the first hit of the pixel's
+    // ray, which has density 1.
+    lightRatios = light_end >= 1 ? junctionRatios(paths.light, light_end, 1, lightRatios, 1, -dir) : 0;
+    weight = weight / (1 + lightRatios);
+    overallDensity += weight;
+    if (!evaluate) {
+        return;
+    }
+
+    Splat &splat = paths.splats[paths.n_splats++];
+    splat.x = x;
+    splat.y = y;
+    splat.color = Vector3f::ZERO;
+    if (_scene.getGroup()->occluded(connector, tmin, toCamera.abs() - tmin)) {
+        return;
+    }
+
+    // The camera itself does not scatter.
+    Vector3f lightIntensity = light->getMaterial()->getLight() * lightVertex.throughput;
+    if (light_end >= 1) {
+        lightIntensity = lightIntensity * shadeVertex(lightVertex, dir);
+    }
+    splat.color = weight * lightIntensity;
+}
+
+void Renderer::renderProgressive(float tmin, float length, int iters, AccumulationImage &film,
+                                 Checkpoint &state) {
+    int w = _args.width;
+    int h = _args.height;
+
+    // Hand out tiles dynamically so expensive regions do not stall the frame.
+    TileOrder order = TileOrder::Hilbert;
+    tileOrderFromName(_args.tile_order, order);
+    TileScheduler scheduler(w, h, _args.tile_size, order);
+    const std::vector<Tile> &tiles = scheduler.getTiles();
+    int n_tiles = (int) tiles.size();
+
+    // Progressive rendering covers the image in passes of a few samples per
+    // pixel. Each pass continues a tile's sample indices where the last one
+    // stopped, so the final image does not depend on the pass size. With a
+    // time budget or an error target, passes go on until one of them stops
+    // the render instead of after iters samples per pixel.
+    //
+    // Adaptive sampling starts with uniform passes, then gives the tiles
+    // further from the threshold more samples per pass and retires the
+    // tiles that reach it. Without a stopping criterion the samples of
+    // iters uniform passes are shared out between the tiles left.
+    //
+    // A resumed render picks up each pixel's sample count, and with it the
+    // place in the pixel's sample sequence, from its checkpoint. Shard k of
+    // N renders every N-th tile along the hand-out order, starting at k.
+    bool openEnded = _args.time > 0 || _args.target_rel_error > 0;
+    bool adaptive = _args.adaptive > 0;
+    int passSize = _args.pass > 0 ? _args.pass : (openEnded || adaptive ? default_pass_size : iters);
+
+    int32_t *pixelSamples = state.seedSamples(0);
+
+    std::vector<int> shardTiles;
+    int64_t shardPixels = 0;
+    int64_t spent = 0;
+    for (int t = _args.shard_index; t < n_tiles; t += _args.shard_count) {
+        shardTiles.push_back(t);
+        const Tile &tile = tiles[t];
+        shardPixels += (tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+        for (int i = tile.y0; i < tile.y1; ++i) {
+            for (int j = tile.x0; j < tile.x1; ++j) {
+                spent += pixelSamples[i * w + j];
+            }
+        }
+    }
+    int64_t budget = (int64_t) iters * shardPixels;
+    std::vector<int> active(shardTiles);
+    std::vector<int> tileCount(n_tiles, 0);
+    std::vector<float> tileNoise(n_tiles, 0.f);
+
+    PassStatistics stats(w, h);
+    stats.startFrom(film);
+    auto start = std::chrono::steady_clock::now();
+    auto lastSnapshot = start;
+    int passesSinceSnapshot = 0;
+    for (int pass = 1; !active.empty(); pass++) {
+        // Samples per pixel for each active tile in this pass. The image's
+        // squared error is least when every tile's samples grow with the
+        // spread of its samples, so tiles get samples by their standard
+        // error over the active tiles' mean.
+        float meanNoise = 0;
+        if (adaptive && pass > uniform_passes) {
+            for (int t : active) {
+                meanNoise += tileNoise[t] / active.size();
+            }
+        }
+        int64_t cost = 0;
+        for (int t : active) {
+            int count = passSize;
+            if (meanNoise > 0) {
+                int boost = (int) std::min(tileNoise[t] / meanNoise + 0.5f, (float) max_adaptive_boost);
+                count *= std::max(boost, 1);
+            }
+            tileCount[t] = count;
+            cost += (int64_t) count * (tiles[t].x1 - tiles[t].x0) * (tiles[t].y1 - tiles[t].y0);
+        }
+        if (!openEnded && spent + cost > budget) {
+            // Scale the last pass down to what is left of the budget.
+            int64_t left = budget - spent;
+            if (left <= 0) {
+                break;
+            }
+            for (int t : active) {
+                tileCount[t] = (int) std::max<int64_t>(1, tileCount[t] * left / cost);
+            }
+        }
+
+        auto passStart = std::chrono::steady_clock::now();
+        scheduler.run(active, [&](int t, const Tile &tile) {
+            for (int i = tile.y0; i < tile.y1; ++i) {
+                for (int j = tile.x0; j < tile.x1; ++j) {
+                    estimatePixel(pixelRay(j, i), j, i, tmin, length, pixelSamples[i * w + j], tileCount[t], film);
+                    pixelSamples[i * w + j] += tileCount[t];
+                }
+            }
+        });
+        for (int t : active) {
+            spent += (int64_t) tileCount[t] * (tiles[t].x1 - tiles[t].x0) * (tiles[t].y1 - tiles[t].y0);
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        float error = 0;
+        if (openEnded || adaptive) {
+            stats.addPass(film);
+            for (int t : shardTiles) {
+                const Tile &tile = tiles[t];
+                error = std::max(error, stats.maxRelativeError(tile.x0, tile.y0, tile.x1, tile.y1));
+            }
+        }
+        if (adaptive && pass >= uniform_passes) {
+            std::vector<int> left;
+            for (int t : active) {
+                const Tile &tile = tiles[t];
+                if (stats.rmsRelativeError(tile.x0, tile.y0, tile.x1, tile.y1) > _args.adaptive) {
+                    tileNoise[t] = stats.rmsStandardError(tile.x0, tile.y0, tile.x1, tile.y1);
+                    left.push_back(t);
+                }
+            }
+            active.swap(left);
+        }
+
+        bool done = active.empty();
+        if (openEnded) {
+            // Stop if another pass like this one would overrun the budget.
+            float elapsed = std::chrono::duration<float>(now - start).count();
+            float passTime = std::chrono::duration<float>(now - passStart).count();
+            done = done || (_args.time > 0 && elapsed + passTime > _args.time) ||
+                   (_args.target_rel_error > 0 && error <= _args.target_rel_error);
+        } else {
+            done = done || spent >= budget;
+        }
+        if (done) {
+            if (openEnded || adaptive) {
+                float elapsed = std::chrono::duration<float>(now - start).count();
+                printf("Stopped after %.1f samples per pixel, %.1fs, relative error %g, %d of %d tiles active\n",
+                       (double) spent / std::max<int64_t>(shardPixels, 1), elapsed, error, (int) active.size(),
+                       (int) shardTiles.size());
+            }
+            // The last pass is written by the caller.
+            break;
+        }
+
+        passesSinceSnapshot++;
+        float sinceSnapshot = std::chrono::duration<float>(now - lastSnapshot).count();
+        bool due = (_args.snapshot_passes > 0 && passesSinceSnapshot >= _args.snapshot_passes) ||
+                   (_args.snapshot > 0 && sinceSnapshot >= _args.snapshot);
+        if (due) {
+            writeSnapshot(film);
+            saveCheckpoint(film, state);
+            printf("Pass %d: %.1f samples per pixel, %d of %d tiles active\n", pass,
+                   (double) spent / std::max<int64_t>(shardPixels, 1), (int) active.size(), (int) shardTiles.size());
+            fflush(stdout);
+            lastSnapshot = now;
+            passesSinceSnapshot = 0;
+        }
+    }
+    saveCheckpoint(film, state);
+}
+
+bool Renderer::Render(std::string &error) {
     // Loop through all the pixels in the image
     // generate all the samples. Fetch necessary args.
     int w = _args.width;
@@ -214,26 +881,30 @@ void Renderer::Render() {
 
     // This look generates camera rays and calls traceRay.
     // It also write to the color image.
-    Image image(w, h);
-    Camera *cam = _scene.getCamera();
-
-    parallel_for(h, [&](int start, int end) {
-        for (int i = start; i < end; ++i) {
-            float ndcy = 2 * (i / (h - 1.0f)) - 1.0f;
-            parallel_for(w, [&](int innerStart, int innerEnd) {
-                for (int j = innerStart; j < innerEnd; ++j) {
-                    // Use PerspectiveCamera to generate a ray.
-                    float ndcx = 2 * (j / (w - 1.0f)) - 1.0f;
-                    Ray r = cam->generateRay(Vector2f(ndcx, ndcy));
-                    Vector3f color = estimatePixel(r, 0.01, length, iters);
-                    image.setPixel(j, i, color);
-                }
-            }, true);
+    AccumulationImage film(w, h);
+    if (_args.shard_count > 1 && _args.checkpoint_file.empty()) {
+        error = "A shard needs -checkpoint to write its part of the film";
+        return false;
+    }
+    if (_mode == RenderMode::Pssmlt || _mode == RenderMode::Mmlt) {
+        if (!_args.checkpoint_file.empty() || !_args.resume_file.empty() || !_args.merge_files.empty() ||
+            _args.shard_count > 1) {
+            error = "Checkpoints and shards need a progressive mode";
+            return false;
         }
-    }, true);
+        renderMetropolis(0.01, length, iters, film);
+    } else {
+        Checkpoint state;
+        if (!restoreCheckpoints(film, state, error)) {
+            return false;
+        }
+        renderProgressive(0.01, length, iters, film, state);
+    }
+    Image image = film.resolve();
 
     // Save the output file.
     if (!_args.output_file.empty()) {
         image.savePNG(_args.output_file);
     }
+    return true;
 }
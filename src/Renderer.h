@@ -1,14 +1,24 @@
 #ifndef RENDERER_H
 #define RENDERER_H
 
+#include <memory>
 #include <string>
+#include <vector>
 
+#include "Image.h"
+#include "PathVertex.h"
 #include "Ray.h"
+#include "RenderMode.h"
+#include "SampleGenerator.h"
 #include "SceneParser.h"
 #include "ArgParser.h"
 
+class Camera;
+
 class Hit;
 
+struct Checkpoint;
+
 class Vector3f;
 
 class Ray;
@@ -18,38 +28,138 @@ public:
     // Instantiates a renderer for the given scene.
     Renderer(const ArgParser &args);
 
-    void Render();
+    // Renders a scene parsed earlier, which must outlive the renderer and
+    // must be the scene args name.
+    Renderer(const ArgParser &args, SceneParser &scene);
+
+    // Renders the image and writes the output file. Returns false, with the
+    // reason in error, if the options do not fit together or a checkpoint
+    // cannot be used; nothing is rendered then.
+    bool Render(std::string &error);
 
 private:
-    Vector3f estimatePixel(const Ray &ray, float tmin, float length, int iters);
+    struct PathStorage;
+    struct Replica;
+
+    // Reads the options shared by both constructors.
+    void init();
+
+    // Color landing in pixel (x, y).
+    struct Splat {
+        int x;
+        int y;
+        Vector3f color;
+    };
+
+    // One connection of a sample: eye vertex eye_end to light vertex
+    // light_end, or light_end to the camera when eye_end is the number of
+    // eye vertices.
+    struct Strategy {
+        int eye_end;
+        int light_end;
+    };
+
+    // The calling thread's scratch space for paths.
+    static PathStorage &threadPaths();
+
+    // Ray through the center of pixel (x, y).
+    Ray pixelRay(int x, int y) const;
+
+    // Traces samples first to first + count - 1 of pixel (x, y) and adds
+    // them to the film. Light vertices the camera sees are splatted to the
+    // pixels they project to.
+    void estimatePixel(const Ray &ray, int x, int y, float tmin, float length, int first, int count,
+                       AccumulationImage &film);
+
+    // Renders the image in progressive passes over the tiles, adaptively
+    // with -adaptive, with iters samples per pixel unless a time budget or
+    // an error target stops it.
+    // The render continues from state, as restoreCheckpoints set it.
+    void renderProgressive(float tmin, float length, int iters, AccumulationImage &film, Checkpoint &state);
+
+    // Sets state to an empty render with this run's seed, adds the
+    // checkpoints given by -resume and -merge to it, and adds their films
+    // to film. A resumed checkpoint's first seed must be this run's.
+    // Returns false, with the reason in error, if a checkpoint is missing or
+    // belongs to another render.
+    bool restoreCheckpoints(AccumulationImage &film, Checkpoint &state, std::string &error) const;
+
+    // Writes the film and the sample counts in state to the -checkpoint
+    // file.
+    void saveCheckpoint(const AccumulationImage &film, Checkpoint &state) const;
+
+    // Writes the film as it stands to the output file.
+    void writeSnapshot(const AccumulationImage &film) const;
+
+    // Traces sample `index` of pixel (x, y) and returns its color for that
+    // pixel. The light subpath's splats are left in paths. Given a strategy
+    // sample, only the connection it picks among the sample's connections
+    // is evaluated, scaled by their number.
+    Vector3f traceSample(const Ray &ray, int x, int y, int index, float tmin, float length, PathStorage &paths,
+                         SampleGenerator &gen, const Vector2f *strategySample = NULL) const;
+
+    // Runs Metropolis chains over the image, with iters mutations per pixel
+    // on average. With more than one temperature, each chain is a ladder of
+    // replicas that exchange states, and only the coldest one records.
+    void renderMetropolis(float tmin, float length, int iters, AccumulationImage &film);
+
+    // Traces the path sample of the chain's current state into records, and
+    // returns the luminance of all its colors. Multiplexed states also pick
+    // the connection to evaluate.
+    float metropolisSample(float tmin, float length, bool multiplexed, MetropolisGenerator &gen,
+                           PathStorage &paths, std::vector<Splat> &records) const;
+
+    void choosePath(const Ray &r, Object3D *light, float tmin, float length, PathStorage &paths,
+                    SampleGenerator &gen) const;
+
+    // Follows r for up to length - 1 bounces, appending a vertex per hit to
+    // vertices[count...]. Returns the new vertex count.
+    int tracePath(const Ray &r, float tmin, int length, PathVertex *vertices, int count, bool light_path,
+                  SampleGenerator &gen) const;
+
+    // Light scattered at v toward dir.
+    Vector3f shadeVertex(const PathVertex &v, const Vector3f &dir) const;
+
+    // Density of the sampler leaving v toward out, having arrived along in.
+    float vertexPdf(const PathVertex &v, const Vector3f &in, const Vector3f &out) const;
 
-    void choosePath(const Ray &r, Object3D *light, float tmin, float length, float &prob_path,
-                    std::vector<Ray> &eye_path, std::vector<Hit> &eye_hits, std::vector<Ray> &light_path,
-                    std::vector<Hit> &light_hits) const;
+    // MIS ratio sum of a subpath ending at vertices[end], when it connects to
+    // a vertex that would sample vertices[end] with density pdfToEnd,
+    // arriving along in. Vertices before first never move. sumBefore is the
+    // running ratio sum up to end - 2.
+    float junctionRatios(const PathVertex *vertices, int end, int first, float sumBefore, float pdfToEnd,
+                         const Vector3f &in) const;
 
-    void tracePath(const Ray &r, float tmin, int length, float &prob_path, std::vector<Ray> &path,
-                   std::vector<Hit> &hits) const;
+    // Pixel whose camera ray passes closest to point, if any.
+    bool pixelOf(const Vector3f &point, int &x, int &y) const;
 
-    void
-    precomputeCumulativeBSDF(const std::vector<Ray> &path, const std::vector<Hit> &hits, std::vector<Vector3f> &bsdf,
-                             std::vector<float> &pdf);
+    // Colors the sample's own pixel with the eye subpath's combinations, and
+    // leaves the light subpath's connections to the camera in paths.splats.
+    // Given only, every combination is weighted but only that one is traced.
+    Vector3f colorPath(float tmin, Object3D *light, PathStorage &paths, const Strategy *only = NULL) const;
 
-    Vector3f colorPath(float tmin, Object3D *light, const std::vector<Ray> &eye_path, std::vector<Hit> &eye_hits,
-                       const std::vector<Ray> &light_path, std::vector<Hit> &light_hits);
+    // Connects eye vertex eye_end to light vertex light_end. eyeRatios and
+    // lightRatios are the MIS ratio sums of the vertices more than one step
+    // from the connection, and emitted is the light found along the eye path
+    // up to eye_end. Without evaluate, only the weight is recorded.
+    Vector3f colorPathCombination(float tmin, Object3D *light, const PathStorage &paths, int eye_end, int light_end,
+                                  float weight, float eyeRatios, float lightRatios, const Vector3f &emitted,
+                                  bool evaluate, float &overallDensity) const;
 
-    Vector3f
-    colorPathCombination(float tmin, Object3D *light, const std::vector<Ray> &eye_path,
-                         const std::vector<Hit> &eye_hits,
-                         const std::vector<Vector3f> &eye_bsdf, const std::vector<float> &eye_pdfs,
-                         const std::vector<Ray> &light_path,
-                         const std::vector<Hit> &light_hits, const std::vector<Vector3f> &light_bsdf,
-                         const std::vector<float> &light_pdfs,
-                         unsigned long eye_length,
-                         unsigned long light_length,
-                         float &overallDensity);
+    // Connects light vertex light_end to the camera, recording a splat for
+    // the pixel it lands in. Without evaluate, only the weight is recorded.
+    void connectToCamera(float tmin, Object3D *light, PathStorage &paths, int light_end, float weight,
+                         float lightRatios, bool evaluate, float &overallDensity) const;
 
     ArgParser _args;
-    SceneParser _scene;
+    // Set when the renderer parsed the scene itself.
+    std::unique_ptr<SceneParser> _ownedScene;
+    SceneParser &_scene;
+    // The camera given by -camera, in place of the scene's.
+    std::unique_ptr<Camera> _cameraOverride;
+    Camera *_camera;
+    SamplePattern _pattern;
+    RenderMode _mode;
 };
 
 #endif // RENDERER_H
@@ -0,0 +1,65 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <cmath>
+#include <cstdint>
+
+// PCG32 generator (O'Neill 2014). Sixteen bytes of state, so every path
+// carries its own and no state is shared between threads.
+class Rng {
+public:
+    // Generators with the same seed and different streams are independent.
+    explicit Rng(uint64_t seed, uint64_t stream = 0) :
+            _state(0),
+            _inc((stream << 1) | 1) {
+        next();
+        _state += seed;
+        next();
+    }
+
+    uint32_t next() {
+        uint64_t old = _state;
+        _state = old * 6364136223846793005ULL + _inc;
+        uint32_t xorshifted = (uint32_t) (((old >> 18) ^ old) >> 27);
+        uint32_t rot = (uint32_t) (old >> 59);
+        return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+    }
+
+    // Uniform in [0, 1).
+    float uniform() {
+        return (next() >> 8) * (1.f / 16777216.f);
+    }
+
+    // Uniform in [a, b).
+    float uniform(float a, float b) {
+        return a + (b - a) * uniform();
+    }
+
+    // Uniform integer in [0, n).
+    int uniformInt(int n) {
+        return (int) (((uint64_t) next() * (uint32_t) n) >> 32);
+    }
+
+    // Failures before the first success of trials with probability p, like
+    // std::geometric_distribution.
+    int geometric(float p) {
+        if (p >= 1) {
+            return 0;
+        }
+        return (int) std::floor(std::log1p(-uniform()) / std::log1p(-p));
+    }
+
+    // Mixes two keys into a seed (splitmix64 finalizer).
+    static uint64_t hash(uint64_t a, uint64_t b) {
+        uint64_t z = a * 0x9e3779b97f4a7c15ULL + b;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+private:
+    uint64_t _state;
+    uint64_t _inc;
+};
+
+#endif // RNG_H
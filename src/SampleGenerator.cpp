@@ -0,0 +1,276 @@
+#include "SampleGenerator.h"
+
+#include <algorithm>
+#include <cmath>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+bool
+samplePatternFromName(const std::string &name, SamplePattern &pattern) {
+    if (name == "random") {
+        pattern = SamplePattern::Random;
+    } else if (name == "sobol") {
+        pattern = SamplePattern::Sobol;
+    } else if (name == "halton") {
+        pattern = SamplePattern::Halton;
+    } else if (name == "rank1") {
+        pattern = SamplePattern::Rank1;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void
+SampleGenerator::startSample(int x, int y, int index) {
+    _x = x;
+    _y = y;
+    _index = index;
+    _pixelSeed = Rng::hash(Rng::hash(_seed, (uint64_t) x), (uint64_t) y);
+    _extra = Rng(_pixelSeed, (uint64_t) index);
+    _dim = 0;
+    _end = 0;
+}
+
+// [0, 1) from the top 24 bits of x.
+static inline float
+toUnitFloat(uint32_t x) {
+    return (x >> 8) * (1.f / 16777216.f);
+}
+
+static inline uint32_t
+reverseBits(uint32_t x) {
+    x = ((x & 0x55555555u) << 1) | ((x >> 1) & 0x55555555u);
+    x = ((x & 0x33333333u) << 2) | ((x >> 2) & 0x33333333u);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x >> 4) & 0x0f0f0f0fu);
+    x = ((x & 0x00ff00ffu) << 8) | ((x >> 8) & 0x00ff00ffu);
+    return (x << 16) | (x >> 16);
+}
+
+// Owen scrambling of the bits of x, after Burley, "Practical Hash-based
+// Owen Scrambling" (JCGT 2020). Each bit is flipped by a hash of the bits
+// above it.
+static inline uint32_t
+owenScramble(uint32_t x, uint32_t seed) {
+    x = reverseBits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return reverseBits(x);
+}
+
+// Independent uniform values, hashed from the pixel, sample and dimension.
+class RandomGenerator : public SampleGenerator {
+public:
+    explicit RandomGenerator(uint32_t seed) :
+            SampleGenerator(seed) {}
+
+protected:
+    float sampleDimension(int dim) override {
+        return toUnitFloat((uint32_t) Rng::hash(Rng::hash(_pixelSeed, (uint64_t) _index), (uint64_t) dim));
+    }
+};
+
+// The first two Sobol dimensions, Owen-scrambled and reused for every pair
+// of dimensions with its own scramble and shuffled sample order. Each pair
+// is a (0, 2)-sequence, so any power-of-two prefix is well stratified.
+class SobolGenerator : public SampleGenerator {
+public:
+    explicit SobolGenerator(uint32_t seed) :
+            SampleGenerator(seed) {}
+
+protected:
+    float sampleDimension(int dim) override {
+        uint32_t pairSeed = (uint32_t) Rng::hash(_pixelSeed, (uint64_t) (dim >> 1));
+        uint32_t index = owenScramble((uint32_t) _index, pairSeed);
+
+        uint32_t x = 0;
+        if (dim & 1) {
+            // Generator matrix of the second dimension: v_{k+1} = v_k ^ (v_k >> 1).
+            for (uint32_t v = 0x80000000u; index; index >>= 1, v ^= v >> 1) {
+                if (index & 1) {
+                    x ^= v;
+                }
+            }
+        } else {
+            x = reverseBits(index);
+        }
+        return toUnitFloat(owenScramble(x, (uint32_t) Rng::hash(pairSeed, (uint64_t) (dim & 1))));
+    }
+};
+
+// Halton sequence with a random shift of every digit, keyed by the digits
+// already placed, so each pixel gets its own nested scramble of the points.
+class HaltonGenerator : public SampleGenerator {
+public:
+    explicit HaltonGenerator(uint32_t seed) :
+            SampleGenerator(seed) {}
+
+protected:
+    float sampleDimension(int dim) override {
+        if (dim >= n_primes) {
+            return toUnitFloat((uint32_t) Rng::hash(Rng::hash(_pixelSeed, (uint64_t) _index), (uint64_t) dim));
+        }
+        uint32_t base = primes[dim];
+        uint64_t dimSeed = Rng::hash(_pixelSeed, (uint64_t) dim);
+
+        double invBase = 1.0 / base;
+        double scale = 1;
+        double result = 0;
+        uint64_t a = (uint64_t) _index;
+        uint64_t prefix = 0;
+        while ((base - 1) * scale > 1e-8) {
+            uint64_t next = a / base;
+            uint32_t digit = (uint32_t) (a - next * base);
+            digit = (digit + (uint32_t) Rng::hash(dimSeed, prefix)) % base;
+            prefix = prefix * base + digit + 1;
+            scale *= invBase;
+            result += digit * scale;
+            a = next;
+        }
+        return std::min((float) result, 0.99999994f);
+    }
+
+private:
+    static const int n_primes = 64;
+    static const uint32_t primes[n_primes];
+};
+
+const uint32_t HaltonGenerator::primes[HaltonGenerator::n_primes] = {
+        2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+        59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131,
+        137, 139, 149, 151, 157, 163, 167, 173, 179, 181, 191, 193, 197, 199, 211, 223,
+        227, 229, 233, 239, 241, 251, 257, 263, 269, 271, 277, 281, 283, 293, 307, 311
+};
+
+// Rank-1 lattice sequence (Roberts' R2) for every pair of dimensions. Each
+// pixel shifts the lattice by the R2 dither mask of its position, which
+// spreads the error between neighbouring pixels as blue noise. Every pair
+// reads the lattice in its own order, an Owen scramble of the sample index
+// that maps each aligned power-of-two block of indices onto another, so
+// pairs are decorrelated while any power-of-two prefix is still a whole
+// block of the lattice. A shift alone would leave all pairs one sequence.
+class Rank1Generator : public SampleGenerator {
+public:
+    explicit Rank1Generator(uint32_t seed) :
+            SampleGenerator(seed) {}
+
+protected:
+    float sampleDimension(int dim) override {
+        // 1/g and 1/g^2 for the plastic number g, in 0.32 fixed point.
+        static const uint32_t alpha[2] = {3242174889u, 2447445413u};
+        int d = dim & 1;
+        uint32_t pairSeed = (uint32_t) Rng::hash(_seed, ~(uint64_t) (dim >> 1));
+        uint32_t index = owenScramble((uint32_t) _index, pairSeed);
+        uint32_t mask = (uint32_t) _x * alpha[d] + (uint32_t) _y * alpha[1 - d];
+        uint32_t shift = mask + (uint32_t) Rng::hash(_seed, (uint64_t) dim);
+        return toUnitFloat(shift + index * alpha[d]);
+    }
+};
+
+std::unique_ptr<SampleGenerator>
+createSampleGenerator(SamplePattern pattern, uint32_t seed) {
+    switch (pattern) {
+        case SamplePattern::Sobol:
+            return std::unique_ptr<SampleGenerator>(new SobolGenerator(seed));
+        case SamplePattern::Halton:
+            return std::unique_ptr<SampleGenerator>(new HaltonGenerator(seed));
+        case SamplePattern::Rank1:
+            return std::unique_ptr<SampleGenerator>(new Rank1Generator(seed));
+        case SamplePattern::Random:
+        default:
+            return std::unique_ptr<SampleGenerator>(new RandomGenerator(seed));
+    }
+}
+
+MetropolisGenerator::MetropolisGenerator(uint32_t seed, uint64_t stream, float sigma, float largeStepProbability) :
+        SampleGenerator(seed),
+        _rng(seed, stream),
+        _sigma(sigma),
+        _largeStepProbability(largeStepProbability),
+        _iteration(0),
+        _largeStep(true),
+        _lastLargeStep(0) {}
+
+void
+MetropolisGenerator::startIteration() {
+    _iteration++;
+    _largeStep = _rng.uniform() < _largeStepProbability;
+}
+
+void
+MetropolisGenerator::accept() {
+    if (_largeStep) {
+        _lastLargeStep = _iteration;
+    }
+}
+
+void
+MetropolisGenerator::reject() {
+    for (PrimarySample &x : _samples) {
+        if (x.modified == _iteration) {
+            x.value = x.backup;
+            x.modified = x.backupModified;
+        }
+    }
+    _iteration--;
+}
+
+Vector2f
+MetropolisGenerator::getFilmSample() {
+    float u = ensureReady(0);
+    float v = ensureReady(1);
+    return Vector2f(u, v);
+}
+
+Vector2f
+MetropolisGenerator::getStrategySample() {
+    float u = ensureReady(2);
+    float v = ensureReady(3);
+    return Vector2f(u, v);
+}
+
+float
+MetropolisGenerator::sampleDimension(int dim) {
+    return ensureReady(state_dims + dim);
+}
+
+float
+MetropolisGenerator::ensureReady(int index) {
+    if (index >= (int) _samples.size()) {
+        PrimarySample fresh = {0, 0, -1, -1};
+        _samples.resize(index + 1, fresh);
+    }
+    PrimarySample &x = _samples[index];
+    if (x.modified == _iteration) {
+        return x.value;
+    }
+
+    // A large step since the last read replaced the value.
+    if (x.modified < _lastLargeStep) {
+        x.value = _rng.uniform();
+        x.modified = _lastLargeStep;
+    }
+
+    x.backup = x.value;
+    x.backupModified = x.modified;
+    if (_largeStep) {
+        x.value = _rng.uniform();
+    } else {
+        // The small steps missed since the last read add up to one normal
+        // offset with their summed variance.
+        int64_t steps = _iteration - x.modified;
+        float u1 = std::max(_rng.uniform(), 1e-7f);
+        float u2 = _rng.uniform();
+        float normal = std::sqrt(-2 * std::log(u1)) * std::cos(2 * (float) M_PI * u2);
+        x.value += normal * _sigma * std::sqrt((float) steps);
+        x.value -= std::floor(x.value);
+        x.value = std::min(x.value, 0.99999994f);
+    }
+    x.modified = _iteration;
+    return x.value;
+}
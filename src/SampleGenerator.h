@@ -0,0 +1,182 @@
+#ifndef SAMPLE_GENERATOR_H
+#define SAMPLE_GENERATOR_H
+
+#include "Rng.h"
+#include "Vector2f.h"
+
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Point sets the path sampler can draw from.
+enum class SamplePattern {
+    Random,
+    Sobol,
+    Halton,
+    Rank1
+};
+
+// Parses "random", "sobol", "halton" or "rank1". Returns false if unknown.
+bool samplePatternFromName(const std::string &name, SamplePattern &pattern);
+
+// Dimension layout of one path sample. Every pattern reads the same decision
+// from the same dimension, and 2D decisions start on even dimensions so they
+// use one stratified pair.
+namespace SampleDims {
+const int light_choice = 0;
+// Light and eye path lengths.
+const int path_lengths = 2;
+// Point and direction on the light.
+const int light_emission = 4;
+const int first_bounce = 8;
+// One scattering event: lobe choice and a direction.
+const int bounce_dims = 4;
+
+// Block for the k-th scattering event of the eye or light subpath.
+inline int bounce(int k, bool light_path) {
+    return first_bounce + (2 * k + (light_path ? 1 : 0)) * bounce_dims;
+}
+}
+
+// Source of the random numbers for one path sample. The renderer opens a
+// block of dimensions before each sampling decision; draws past the end of
+// a block, such as rejection retries, come from an independent stream so
+// they never alias the next block.
+class SampleGenerator {
+public:
+    explicit SampleGenerator(uint32_t seed) :
+            _seed(seed),
+            _dim(0),
+            _end(0),
+            _pixelSeed(0),
+            _index(0),
+            _x(0),
+            _y(0),
+            _extra(0) {}
+
+    virtual ~SampleGenerator() {}
+
+    // Starts sample `index` of pixel (x, y).
+    void startSample(int x, int y, int index);
+
+    // Moves to dimension `dim`, with `count` dimensions reserved from there.
+    void startBlock(int dim, int count) {
+        _dim = dim;
+        _end = dim + count;
+    }
+
+    float get1D() {
+        if (_dim >= _end) {
+            return _extra.uniform();
+        }
+        return sampleDimension(_dim++);
+    }
+
+    // Both coordinates come from one even-odd pair of dimensions.
+    Vector2f get2D() {
+        if (_dim & 1) {
+            _dim++;
+        }
+        if (_dim + 1 >= _end) {
+            return Vector2f(_extra.uniform(), _extra.uniform());
+        }
+        float u = sampleDimension(_dim);
+        float v = sampleDimension(_dim + 1);
+        _dim += 2;
+        return Vector2f(u, v);
+    }
+
+    // Uniform in [a, b).
+    float uniform(float a, float b) {
+        return a + (b - a) * get1D();
+    }
+
+    // Uniform integer in [0, n).
+    int uniformInt(int n) {
+        int k = (int) (get1D() * n);
+        return k < n ? k : n - 1;
+    }
+
+    // Failures before the first success of trials with probability p, by
+    // inverting the distribution so stratification carries over.
+    int geometric(float p) {
+        if (p >= 1) {
+            return 0;
+        }
+        return (int) std::floor(std::log1p(-get1D()) / std::log1p(-p));
+    }
+
+protected:
+    // Value of dimension `dim` for the current sample, in [0, 1).
+    virtual float sampleDimension(int dim) = 0;
+
+    uint32_t _seed;
+    int _dim;
+    int _end;
+    // Hash of the seed and pixel, for per-pixel scrambling.
+    uint64_t _pixelSeed;
+    int _index;
+    int _x;
+    int _y;
+    Rng _extra;
+};
+
+std::unique_ptr<SampleGenerator> createSampleGenerator(SamplePattern pattern, uint32_t seed);
+
+// Primary sample space state of a Metropolis chain, after Kelemen et al.,
+// "A Simple and Robust Mutation Strategy for the Metropolis Light Transport
+// Algorithm" (2002). Every dimension keeps its value between iterations. A
+// large step redraws them all; a small step perturbs each one by a normal
+// offset. Dimensions are brought up to date when they are first read in an
+// iteration, so a path may read any number of them. The film position and
+// a strategy choice are part of the state, ahead of the renderer's
+// dimensions.
+class MetropolisGenerator : public SampleGenerator {
+public:
+    // Generators with the same seed and stream start from the same state.
+    MetropolisGenerator(uint32_t seed, uint64_t stream, float sigma, float largeStepProbability);
+
+    // Proposes the next state. The first state, before any call, is a large
+    // step.
+    void startIteration();
+
+    // Keeps the proposed state.
+    void accept();
+
+    // Returns to the state before the proposal.
+    void reject();
+
+    // Position on the film, in [0, 1)^2.
+    Vector2f getFilmSample();
+
+    // Choice of the connection to evaluate, in [0, 1)^2.
+    Vector2f getStrategySample();
+
+protected:
+    float sampleDimension(int dim) override;
+
+private:
+    struct PrimarySample {
+        float value;
+        float backup;
+        int64_t modified;
+        int64_t backupModified;
+    };
+
+    static const int state_dims = 4;
+
+    // Applies the mutations since the value was last read.
+    float ensureReady(int index);
+
+    Rng _rng;
+    float _sigma;
+    float _largeStepProbability;
+    std::vector<PrimarySample> _samples;
+    int64_t _iteration;
+    bool _largeStep;
+    int64_t _lastLargeStep;
+};
+
+#endif // SAMPLE_GENERATOR_H
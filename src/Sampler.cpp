@@ -1,19 +1,16 @@
 #include "Sampler.h"
 #include "Material.h"
 
-#include <random>
 #include <cmath>
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
 #endif
 
-Vector3f cosineWeightedHemisphere::sample(const Ray &ray, Hit &h) const {
-    std::default_random_engine generator(rand());
-    std::uniform_real_distribution<float> uniform(0.f, 1.f);
-
-    float r = sqrt(uniform(generator));
-    float v = 2.f * (float)M_PI * uniform(generator);
+Vector3f cosineWeightedHemisphere::sample(const Ray &ray, Hit &h, SampleGenerator &gen) const {
+    Vector2f u = gen.get2D();
+    float r = sqrt(u[0]);
+    float v = 2.f * (float)M_PI * u[1];
     Vector3f normal = h.getNormal();
 
     // TODO: think of a better way to do this
@@ -31,7 +28,7 @@ float cosineWeightedHemisphere::pdf(const Ray &ray, const Vector3f &dir, Hit &h)
     return dot / M_PI;
 }
 
-Vector3f pureReflectance::sample(const Ray &ray, Hit &h) const {
+Vector3f pureReflectance::sample(const Ray &ray, Hit &h, SampleGenerator &gen) const {
     return (ray.getDirection() - 2 * Vector3f::dot(ray.getDirection(), h.getNormal()) * h.getNormal()).normalized();
 }
 
@@ -39,18 +36,16 @@ float pureReflectance::pdf(const Ray &ray, const Vector3f &dir, Hit &h) const {
     return 1;
 }
 
-Vector3f blinnPhong::sample(const Ray &ray, Hit &h) const {
+Vector3f blinnPhong::sample(const Ray &ray, Hit &h, SampleGenerator &gen) const {
     float shininess = h.getMaterial()->getShininess();
     Vector3f diff = h.getMaterial()->getDiffuseColor();
     Vector3f spec = h.getMaterial()->getSpecularColor();
     float prob_spec = 1.f / (1.f + (diff[0] + diff[1] + diff[2]) / (spec[0] + spec[1] + spec[2]));
     int max_iters = 10;
 
-    std::default_random_engine generator(rand());
-    std::uniform_real_distribution<float> uniform(0.f, 1.f);
-
-    float u = uniform(generator);
-    float v = 2.f * (float)M_PI * uniform(generator);
+    Vector2f uv = gen.get2D();
+    float u = uv[0];
+    float v = 2.f * (float)M_PI * uv[1];
     float sin_v = sin(v);
     float cos_v = cos(v);
 
@@ -61,7 +56,7 @@ Vector3f blinnPhong::sample(const Ray &ray, Hit &h) const {
     Vector3f y;
     Vector3f output = -h.getNormal();
 
-    if (uniform(generator) > prob_spec) {
+    if (gen.get1D() > prob_spec) {
         // do diffuse distribution
         r = sqrt(u);
         factor = sqrt(1-r*r);
@@ -86,7 +81,7 @@ Vector3f blinnPhong::sample(const Ray &ray, Hit &h) const {
                 return output;
             }
 
-            u = uniform(generator);
+            u = gen.get1D();
             v = fmod(v + 0.4, 2 * M_PI);
             sin_v = sin(v); cos_v = cos(v);
         }
@@ -135,20 +130,15 @@ float blinnPhong::pdf(const Ray &ray, const Vector3f &dir, Hit &h) const {
 
 }
 
-Vector3f experimental::sample(const Ray &ray, Hit &h) const {
+Vector3f experimental::sample(const Ray &ray, Hit &h, SampleGenerator &gen) const {
     Vector3f diff = h.getMaterial()->getDiffuseColor();
     Vector3f spec = h.getMaterial()->getSpecularColor();
     float prob_spec = 1.f / (1.f + (diff[0] + diff[1] + diff[2]) / (spec[0] + spec[1] + spec[2]));
 
-    std::default_random_engine generator(rand());
-    std::uniform_real_distribution<float> uniform(0.f, 1.f);
-
-    if (uniform(generator) > prob_spec) {
-        Sampler* sampler = new cosineWeightedHemisphere;
-        return sampler->sample(ray, h);
+    if (gen.get1D() > prob_spec) {
+        return cosineWeightedHemisphere().sample(ray, h, gen);
     } else {
-        Sampler* sampler = new pureReflectance;
-        return sampler->sample(ray, h);
+        return pureReflectance().sample(ray, h, gen);
     }
 }
 
@@ -158,10 +148,8 @@ float experimental::pdf(const Ray &ray, const Vector3f &dir, Hit &h) const {
     float prob_spec = 1.f / (1.f + (diff[0] + diff[1] + diff[2]) / (spec[0] + spec[1] + spec[2]));
 
     float pdf = 0;
-    Sampler* sampler_diff = new cosineWeightedHemisphere;
-    pdf += (1-prob_spec) * sampler_diff->pdf(ray, dir, h);
-    Sampler* sampler_ref = new pureReflectance;
-    pdf += prob_spec * sampler_ref->pdf(ray, dir, h);
+    pdf += (1-prob_spec) * cosineWeightedHemisphere().pdf(ray, dir, h);
+    pdf += prob_spec * pureReflectance().pdf(ray, dir, h);
 
     return pdf;
 }
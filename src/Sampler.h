@@ -2,6 +2,7 @@
 #define METROCASTER_SAMPLER_H
 
 #include "Ray.h"
+#include "SampleGenerator.h"
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
@@ -13,36 +14,45 @@ public:
     Sampler() {};
     virtual ~Sampler() {};
 
-    virtual Vector3f sample(const Ray &ray, Hit &h) const {
+    // Draws an outgoing direction at the hit, taking random numbers from gen.
+    virtual Vector3f sample(const Ray &ray, Hit &h, SampleGenerator &gen) const {
         return Vector3f(0);
     };
 
     virtual float pdf(const Ray &ray, const Vector3f &dir, Hit &h) const {
         return 1 / (4 * M_PI);
     }
+
+    // True if sampled directions come from a delta distribution.
+    virtual bool isDelta() const {
+        return false;
+    }
 };
 
 class cosineWeightedHemisphere : public Sampler {
 public:
-    virtual Vector3f sample(const Ray &ray, Hit &h) const override;
+    virtual Vector3f sample(const Ray &ray, Hit &h, SampleGenerator &gen) const override;
     virtual float pdf(const Ray &ray, const Vector3f &dir, Hit &h) const override;
 };
 
 class pureReflectance : public Sampler {
 public:
-    virtual Vector3f sample(const Ray &ray, Hit &h) const override;
+    virtual Vector3f sample(const Ray &ray, Hit &h, SampleGenerator &gen) const override;
     virtual float pdf(const Ray &ray, const Vector3f &dir, Hit &h) const override;
+    virtual bool isDelta() const override {
+        return true;
+    }
 };
 
 class blinnPhong : public Sampler {
 public:
-    virtual Vector3f sample(const Ray &ray, Hit &h) const override;
+    virtual Vector3f sample(const Ray &ray, Hit &h, SampleGenerator &gen) const override;
     virtual float pdf(const Ray &ray, const Vector3f &dir, Hit &h) const override;
 };
 
 class experimental : public Sampler {
 public:
-    virtual Vector3f sample(const Ray &ray, Hit &h) const override;
+    virtual Vector3f sample(const Ray &ray, Hit &h, SampleGenerator &gen) const override;
     virtual float pdf(const Ray &ray, const Vector3f &dir, Hit &h) const override;
 };
 
@@ -56,6 +56,7 @@ SceneParser::SceneParser(const std::string &filename) :
     if (_file == NULL) {
         _PostError(std::string("Cannot open scene file ") + filename + "\n");
     }
+    _source_files.push_back(filename);
 
     parseFile();
     fclose(_file);
@@ -162,6 +163,9 @@ CubeMap *
 SceneParser::parseCubeMap() {
     char token[MAX_PARSER_TOKEN_LENGTH];
     getToken(token);
+    for (int face = 0; face < 6; face++) {
+        _source_files.push_back(CubeMap::faceFile(_basepath + token, face));
+    }
     return new CubeMap(_basepath + token);
 }
 
@@ -187,6 +191,7 @@ SceneParser::parseMaterials() {
         if (!strcmp(token, "Material") ||
             !strcmp(token, "PhongMaterial")) {
             _materials.push_back(parseMaterial());
+            _materials.back()->setId(count);
         } else {
             printf("Unknown token in parseMaterial: '%s'\n", token);
             exit(0);
@@ -310,7 +315,8 @@ SceneParser::parseGroup() {
     getToken(token);
     assert(!strcmp(token, "}"));
 
-    // Return the group.
+    // Build the acceleration structure and return the group.
+    answer->build();
     return answer;
 }
 
@@ -425,6 +431,7 @@ SceneParser::parseTriangleMesh() {
     assert(!strcmp(token, "}"));
     const char *ext = &filename[strlen(filename) - 4];
     assert(!strcmp(ext, ".obj"));
+    _source_files.push_back(_basepath + filename);
     Mesh *answer = new Mesh(_basepath + filename, _current_material);
 
     return answer;
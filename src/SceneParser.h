@@ -60,6 +60,12 @@ public:
         return _group;
     }
 
+    // Files the scene was built from: the scene file, then the meshes and
+    // cube map images it loads.
+    const std::vector<std::string> &getSourceFiles() const {
+        return _source_files;
+    }
+
     std::vector<Object3D *> lights;
     Sampler *sampler;
 private:
@@ -115,6 +121,7 @@ private:
     Material *_current_material;
     Group *_group;
     CubeMap *_cubemap;
+    std::vector<std::string> _source_files;
 };
 
 #endif // SCENE_PARSER_H
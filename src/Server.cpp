@@ -0,0 +1,443 @@
+#include "Server.h"
+
+#include "ArgParser.h"
+#include "Renderer.h"
+#include "SceneParser.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <vector>
+
+#ifdef _WIN32
+
+int
+serve(const std::string &socketPath) {
+    printf("The render daemon needs Unix domain sockets\n");
+    return 1;
+}
+
+#else
+
+#include <cerrno>
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Scenes kept loaded at once. The one used longest ago is dropped first.
+static const size_t max_cached_scenes = 4;
+
+namespace {
+    // Size, modification time and change time of a file, to tell whether
+    // it changed. The change time cannot be set back, unlike the
+    // modification time, which cp -p and touch -r copy.
+    struct FileStamp {
+        std::string path;
+        uint64_t size;
+        int64_t mtime_ns;
+        int64_t ctime_ns;
+    };
+
+    // A process that holds one parsed scene and renders the jobs for it.
+    // Loading a scene starts the thread pool, and threads do not survive a
+    // fork, so the daemon never loads scenes itself.
+    struct SceneWorker {
+        std::string input_file;
+        // Every file the scene was loaded from, as it was after loading.
+        std::vector<FileStamp> sources;
+        pid_t pid;
+        // Pipes for jobs to the worker and replies from it.
+        int jobs;
+        int replies;
+        uint64_t last_used;
+    };
+}
+
+// Returns false if the file is missing.
+static bool
+stampFile(const std::string &path, FileStamp &stamp) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return false;
+    }
+    // Whole seconds miss an edit made within the second of the load.
+#ifdef __APPLE__
+    const timespec &mtime = st.st_mtimespec;
+    const timespec &ctime = st.st_ctimespec;
+#else
+    const timespec &mtime = st.st_mtim;
+    const timespec &ctime = st.st_ctim;
+#endif
+    stamp.path = path;
+    stamp.size = (uint64_t) st.st_size;
+    stamp.mtime_ns = (int64_t) mtime.tv_sec * 1000000000 + mtime.tv_nsec;
+    stamp.ctime_ns = (int64_t) ctime.tv_sec * 1000000000 + ctime.tv_nsec;
+    return true;
+}
+
+// Whether every file is still as it was stamped.
+static bool
+sourcesUnchanged(const std::vector<FileStamp> &sources) {
+    for (const FileStamp &source : sources) {
+        FileStamp now;
+        if (!stampFile(source.path, now) || now.size != source.size || now.mtime_ns != source.mtime_ns ||
+            now.ctime_ns != source.ctime_ns) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Reads one line from fd, without its newline. Returns false at the end of
+// the stream if nothing was read.
+static bool
+readLine(int fd, std::string &line) {
+    line.clear();
+    char c;
+    while (true) {
+        ssize_t n = read(fd, &c, 1);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return !line.empty();
+        }
+        if (c == '\n') {
+            return true;
+        }
+        line += c;
+    }
+}
+
+static bool
+writeAll(int fd, const std::string &data) {
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t n = write(fd, data.data() + done, data.size() - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+// Arguments of a job, with a program name in front as ArgParser expects.
+static std::vector<std::string>
+splitArgs(const std::string &line) {
+    std::vector<std::string> args(1, "metrocaster");
+    std::istringstream in(line);
+    std::string token;
+    while (in >> token) {
+        args.push_back(token);
+    }
+    return args;
+}
+
+static std::vector<const char *>
+argPointers(const std::vector<std::string> &args) {
+    std::vector<const char *> argv;
+    for (const std::string &arg : args) {
+        argv.push_back(arg.c_str());
+    }
+    return argv;
+}
+
+// Parses a job's arguments in a child process, since ArgParser exits on bad
+// ones. Returns an empty string if they are fine, or else the last line the
+// parser printed.
+static std::string
+checkJob(const std::vector<std::string> &args) {
+    int out[2];
+    if (pipe(out) != 0) {
+        return "cannot start a process";
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(out[0]);
+        dup2(out[1], STDOUT_FILENO);
+        std::vector<const char *> argv = argPointers(args);
+        ArgParser parsed((int) argv.size(), argv.data());
+        if (parsed.input_file.empty() || parsed.output_file.empty()) {
+            printf("A job needs -input and -output\n");
+            fflush(stdout);
+            _exit(1);
+        }
+        fflush(stdout);
+        _exit(0);
+    }
+    close(out[1]);
+
+    std::string line;
+    std::string last;
+    while (readLine(out[0], line)) {
+        if (!line.empty()) {
+            last = line;
+        }
+    }
+    close(out[0]);
+    int status = 0;
+    if (pid < 0 || waitpid(pid, &status, 0) < 0) {
+        return "cannot start a process";
+    }
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        return "";
+    }
+    return last.empty() ? "bad arguments" : last;
+}
+
+// Body of a worker process: loads the scene and sends the files it was
+// loaded from, one per line after FILE and ended by READY, then renders
+// each job read from jobs and answers on replies.
+static void
+runWorker(const std::string &input_file, int jobs, int replies) {
+    SceneParser scene(input_file);
+    std::string files;
+    for (const std::string &path : scene.getSourceFiles()) {
+        files += "FILE " + path + "\n";
+    }
+    if (!writeAll(replies, files + "READY\n")) {
+        _exit(1);
+    }
+
+    std::string line;
+    while (readLine(jobs, line)) {
+        std::vector<std::string> args = splitArgs(line);
+        std::vector<const char *> argv = argPointers(args);
+        ArgParser parsed((int) argv.size(), argv.data());
+
+        // A job that cannot render is answered with the reason, and the
+        // worker keeps its scene for the next one.
+        auto start = std::chrono::steady_clock::now();
+        Renderer renderer(parsed, scene);
+        std::string error;
+        bool rendered = renderer.Render(error);
+        auto stop = std::chrono::steady_clock::now();
+        fflush(stdout);
+
+        std::ostringstream reply;
+        if (rendered) {
+            reply << "OK " << parsed.output_file << " "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count() << "\n";
+        } else {
+            reply << "ERROR " << error << "\n";
+        }
+        if (!writeAll(replies, reply.str())) {
+            break;
+        }
+    }
+    _exit(0);
+}
+
+static void
+stopWorker(std::vector<SceneWorker> &workers, size_t index) {
+    SceneWorker &worker = workers[index];
+    close(worker.jobs);
+    close(worker.replies);
+    kill(worker.pid, SIGTERM);
+    waitpid(worker.pid, NULL, 0);
+    workers.erase(workers.begin() + index);
+}
+
+// Starts a worker for the scene and waits for it to load. Returns false,
+// with the reason in error, if no process could start or the scene did not
+// load.
+static bool
+startWorker(std::vector<SceneWorker> &workers, const std::string &input_file,
+            const std::vector<int> &closeInChild, std::string &error) {
+    error = "cannot start a process";
+    int jobs[2];
+    int replies[2];
+    if (pipe(jobs) != 0) {
+        return false;
+    }
+    if (pipe(replies) != 0) {
+        close(jobs[0]);
+        close(jobs[1]);
+        return false;
+    }
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        // Other workers' pipes stay with the daemon, so those workers see
+        // their jobs pipe close when the daemon stops them.
+        for (int fd : closeInChild) {
+            close(fd);
+        }
+        for (const SceneWorker &worker : workers) {
+            close(worker.jobs);
+            close(worker.replies);
+        }
+        close(jobs[1]);
+        close(replies[0]);
+        runWorker(input_file, jobs[0], replies[1]);
+    }
+    close(jobs[0]);
+    close(replies[1]);
+    if (pid < 0) {
+        close(jobs[1]);
+        close(replies[0]);
+        return false;
+    }
+
+    SceneWorker worker;
+    worker.input_file = input_file;
+    worker.pid = pid;
+    worker.jobs = jobs[1];
+    worker.replies = replies[0];
+    worker.last_used = 0;
+    workers.push_back(worker);
+
+    // The files are stamped once the scene is loaded, so an edit made
+    // while it loads restarts the worker only if it lands after the stamp.
+    std::string line;
+    bool ready = false;
+    bool stamped = true;
+    while (readLine(worker.replies, line)) {
+        if (line == "READY") {
+            ready = true;
+            break;
+        }
+        if (line.compare(0, 5, "FILE ") == 0) {
+            FileStamp stamp;
+            stamped = stampFile(line.substr(5), stamp) && stamped;
+            workers.back().sources.push_back(stamp);
+        }
+    }
+    if (!ready || !stamped) {
+        error = ready ? "a file of the scene is missing or changed while it loaded"
+                      : "the scene did not load, see the daemon's output";
+        stopWorker(workers, workers.size() - 1);
+        return false;
+    }
+    return true;
+}
+
+// Runs one job line and returns its reply.
+static std::string
+runJob(const std::string &line, std::vector<SceneWorker> &workers, uint64_t now,
+       const std::vector<int> &closeInChild) {
+    std::vector<std::string> args = splitArgs(line);
+    std::string error = checkJob(args);
+    if (!error.empty()) {
+        return "ERROR " + error + "\n";
+    }
+
+    // Find the scene as ArgParser does: the last -input wins.
+    std::string input_file;
+    for (size_t i = 1; i + 1 < args.size(); i++) {
+        if (args[i] == "-input") {
+            input_file = args[i + 1];
+        }
+    }
+    FileStamp stamp;
+    if (!stampFile(input_file, stamp)) {
+        return "ERROR Cannot open scene file " + input_file + "\n";
+    }
+
+    // A scene whose file, meshes or textures changed since it was loaded is
+    // loaded again.
+    size_t index = workers.size();
+    for (size_t i = 0; i < workers.size(); i++) {
+        if (workers[i].input_file == input_file) {
+            index = i;
+            break;
+        }
+    }
+    if (index < workers.size() && !sourcesUnchanged(workers[index].sources)) {
+        stopWorker(workers, index);
+        index = workers.size();
+    }
+    if (index == workers.size()) {
+        if (workers.size() >= max_cached_scenes) {
+            size_t oldest = 0;
+            for (size_t i = 1; i < workers.size(); i++) {
+                if (workers[i].last_used < workers[oldest].last_used) {
+                    oldest = i;
+                }
+            }
+            stopWorker(workers, oldest);
+        }
+        if (!startWorker(workers, input_file, closeInChild, error)) {
+            return "ERROR " + error + "\n";
+        }
+        index = workers.size() - 1;
+    }
+
+    SceneWorker &worker = workers[index];
+    worker.last_used = now;
+    std::string reply;
+    if (!writeAll(worker.jobs, line + "\n") || !readLine(worker.replies, reply)) {
+        // The worker exited: the scene did not load or the render failed.
+        stopWorker(workers, index);
+        return "ERROR render failed, see the daemon's output\n";
+    }
+    return reply + "\n";
+}
+
+int
+serve(const std::string &socketPath) {
+    // A client that hangs up before its reply must not end the daemon.
+    signal(SIGPIPE, SIG_IGN);
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(addr.sun_path)) {
+        printf("Socket path '%s' is too long\n", socketPath.c_str());
+        return 1;
+    }
+    strcpy(addr.sun_path, socketPath.c_str());
+
+    // A socket left by an earlier daemon would make bind fail.
+    unlink(socketPath.c_str());
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || bind(listener, (sockaddr *) &addr, sizeof(addr)) != 0 || listen(listener, 64) != 0) {
+        printf("Cannot listen on '%s'\n", socketPath.c_str());
+        return 1;
+    }
+    printf("Serving on %s\n", socketPath.c_str());
+    fflush(stdout);
+
+    // Clients wait in the listen queue while the current one's jobs run.
+    std::vector<SceneWorker> workers;
+    uint64_t jobs = 0;
+    while (true) {
+        int client = accept(listener, NULL, NULL);
+        if (client < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        std::vector<int> closeInChild = {listener, client};
+        std::string line;
+        while (readLine(client, line)) {
+            if (line.find_first_not_of(" \t\r") == std::string::npos) {
+                continue;
+            }
+            if (!writeAll(client, runJob(line, workers, ++jobs, closeInChild))) {
+                break;
+            }
+        }
+        close(client);
+    }
+
+    while (!workers.empty()) {
+        stopWorker(workers, workers.size() - 1);
+    }
+    close(listener);
+    return 1;
+}
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <string>
+
+// Runs a render daemon on the Unix domain socket at socketPath until it is
+// killed. Clients send one job per line: the arguments of a command line
+// render, separated by spaces, with paths relative to the daemon's working
+// directory. Every job gets one reply line, "OK <output> <milliseconds>"
+// once its image is written, or "ERROR <message>". Jobs run one at a time,
+// in the order they arrive. Parsed scenes, with their acceleration
+// structures, stay loaded between jobs. Returns nonzero if the socket
+// cannot be opened.
+int serve(const std::string &socketPath);
+
+#endif // SERVER_H
@@ -0,0 +1,301 @@
+#include "SimdKernels.h"
+
+#include <algorithm>
+
+// Define SIMD_KERNELS_SCALAR to build the scalar kernels only.
+#if (defined(__x86_64__) || defined(_M_X64)) && !defined(SIMD_KERNELS_SCALAR)
+#define SIMD_KERNELS_SSE 1
+#include <immintrin.h>
+#endif
+
+#if SIMD_KERNELS_SSE && defined(__GNUC__)
+// Compiled for AVX2 regardless of the build flags and only called once the
+// CPU has been checked.
+#define SIMD_KERNELS_AVX2 1
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+// ====================================================================
+// Scalar
+// ====================================================================
+
+static int
+intersectBoxes4Scalar(const BoxPacket4 &boxes, const SimdRay &ray, float tmin, float tmax, float tnear[4]) {
+    int mask = 0;
+    for (int lane = 0; lane < 4; lane++) {
+        float t0 = tmin;
+        float t1 = tmax;
+        for (int dim = 0; dim < 3; dim++) {
+            float a = (boxes.mn[dim][lane] - ray.org[dim]) * ray.invDir[dim];
+            float b = (boxes.mx[dim][lane] - ray.org[dim]) * ray.invDir[dim];
+            if (a > b) {
+                std::swap(a, b);
+            }
+            t0 = a > t0 ? a : t0;
+            t1 = b < t1 ? b : t1;
+        }
+        if (t0 <= t1) {
+            mask |= 1 << lane;
+            tnear[lane] = t0;
+        }
+    }
+    return mask;
+}
+
+static int
+intersectTrianglesScalar(const TrianglePacket4 *packets, int n_packets, const SimdRay &ray,
+                         float tmin, float &tmax, float &beta, float &gamma) {
+    const float *o = ray.org;
+    const float *d = ray.dir;
+    int best = -1;
+    for (int k = 0; k < n_packets; k++) {
+        const TrianglePacket4 &p = packets[k];
+        for (int lane = 0; lane < 4; lane++) {
+            float e1[3] = {p.e1[0][lane], p.e1[1][lane], p.e1[2][lane]};
+            float e2[3] = {p.e2[0][lane], p.e2[1][lane], p.e2[2][lane]};
+            float s[3] = {o[0] - p.v0[0][lane], o[1] - p.v0[1][lane], o[2] - p.v0[2][lane]};
+
+            float px = d[1] * e2[2] - d[2] * e2[1];
+            float py = d[2] * e2[0] - d[0] * e2[2];
+            float pz = d[0] * e2[1] - d[1] * e2[0];
+            float det = e1[0] * px + e1[1] * py + e1[2] * pz;
+            if (det == 0) {
+                continue;
+            }
+            float invDet = 1 / det;
+
+            float b = (s[0] * px + s[1] * py + s[2] * pz) * invDet;
+            if (!(b > 0 && b < 1)) {
+                continue;
+            }
+
+            float qx = s[1] * e1[2] - s[2] * e1[1];
+            float qy = s[2] * e1[0] - s[0] * e1[2];
+            float qz = s[0] * e1[1] - s[1] * e1[0];
+            float g = (d[0] * qx + d[1] * qy + d[2] * qz) * invDet;
+            if (!(g > 0 && b + g < 1)) {
+                continue;
+            }
+
+            float t = (e2[0] * qx + e2[1] * qy + e2[2] * qz) * invDet;
+            if (t > tmin && t < tmax) {
+                tmax = t;
+                beta = b;
+                gamma = g;
+                best = 4 * k + lane;
+            }
+        }
+    }
+    return best;
+}
+
+#if SIMD_KERNELS_SSE
+
+// ====================================================================
+// SSE
+// ====================================================================
+
+static int
+intersectBoxes4SSE(const BoxPacket4 &boxes, const SimdRay &ray, float tmin, float tmax, float tnear[4]) {
+    __m128 t0 = _mm_set1_ps(tmin);
+    __m128 t1 = _mm_set1_ps(tmax);
+    for (int dim = 0; dim < 3; dim++) {
+        __m128 org = _mm_set1_ps(ray.org[dim]);
+        __m128 inv = _mm_set1_ps(ray.invDir[dim]);
+        __m128 a = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(boxes.mn[dim]), org), inv);
+        __m128 b = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(boxes.mx[dim]), org), inv);
+        // The running bound goes second: min/max return it when the slab
+        // distance is NaN, matching the scalar test.
+        t0 = _mm_max_ps(_mm_min_ps(a, b), t0);
+        t1 = _mm_min_ps(_mm_max_ps(a, b), t1);
+    }
+    _mm_storeu_ps(tnear, t0);
+    return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+}
+
+// Moller-Trumbore on one packet. Returns the mask of lanes hit.
+static inline int
+intersectPacketSSE(const TrianglePacket4 &p, const __m128 o[3], const __m128 d[3],
+                   __m128 tmin, __m128 tmax, __m128 &t, __m128 &b, __m128 &g) {
+    __m128 e1x = _mm_load_ps(p.e1[0]), e1y = _mm_load_ps(p.e1[1]), e1z = _mm_load_ps(p.e1[2]);
+    __m128 e2x = _mm_load_ps(p.e2[0]), e2y = _mm_load_ps(p.e2[1]), e2z = _mm_load_ps(p.e2[2]);
+    __m128 sx = _mm_sub_ps(o[0], _mm_load_ps(p.v0[0]));
+    __m128 sy = _mm_sub_ps(o[1], _mm_load_ps(p.v0[1]));
+    __m128 sz = _mm_sub_ps(o[2], _mm_load_ps(p.v0[2]));
+
+    __m128 px = _mm_sub_ps(_mm_mul_ps(d[1], e2z), _mm_mul_ps(d[2], e2y));
+    __m128 py = _mm_sub_ps(_mm_mul_ps(d[2], e2x), _mm_mul_ps(d[0], e2z));
+    __m128 pz = _mm_sub_ps(_mm_mul_ps(d[0], e2y), _mm_mul_ps(d[1], e2x));
+    __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+    __m128 invDet = _mm_div_ps(_mm_set1_ps(1.f), det);
+
+    b = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), invDet);
+
+    __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+    __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+    __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+    g = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(d[0], qx), _mm_mul_ps(d[1], qy)), _mm_mul_ps(d[2], qz)), invDet);
+    t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+    __m128 zero = _mm_setzero_ps();
+    __m128 one = _mm_set1_ps(1.f);
+    __m128 mask = _mm_cmpneq_ps(det, zero);
+    mask = _mm_and_ps(mask, _mm_cmpgt_ps(b, zero));
+    mask = _mm_and_ps(mask, _mm_cmplt_ps(b, one));
+    mask = _mm_and_ps(mask, _mm_cmpgt_ps(g, zero));
+    mask = _mm_and_ps(mask, _mm_cmplt_ps(_mm_add_ps(b, g), one));
+    mask = _mm_and_ps(mask, _mm_cmpgt_ps(t, tmin));
+    mask = _mm_and_ps(mask, _mm_cmplt_ps(t, tmax));
+    return _mm_movemask_ps(mask);
+}
+
+// Picks the closest of the lanes in mask; lower lanes win ties.
+static inline int
+closestLane(int mask, const float *t, const float *b, const float *g, int base,
+            float &tmax, float &beta, float &gamma) {
+    int best = -1;
+    for (int lane = 0; mask >> lane; lane++) {
+        if (!(mask & (1 << lane))) {
+            continue;
+        }
+        if (t[lane] < tmax) {
+            tmax = t[lane];
+            beta = b[lane];
+            gamma = g[lane];
+            best = base + lane;
+        }
+    }
+    return best;
+}
+
+static int
+intersectTrianglesSSE(const TrianglePacket4 *packets, int n_packets, const SimdRay &ray,
+                      float tmin, float &tmax, float &beta, float &gamma) {
+    __m128 o[3] = {_mm_set1_ps(ray.org[0]), _mm_set1_ps(ray.org[1]), _mm_set1_ps(ray.org[2])};
+    __m128 d[3] = {_mm_set1_ps(ray.dir[0]), _mm_set1_ps(ray.dir[1]), _mm_set1_ps(ray.dir[2])};
+    __m128 vtmin = _mm_set1_ps(tmin);
+
+    int best = -1;
+    for (int k = 0; k < n_packets; k++) {
+        __m128 t, b, g;
+        int mask = intersectPacketSSE(packets[k], o, d, vtmin, _mm_set1_ps(tmax), t, b, g);
+        if (mask) {
+            alignas(16) float ts[4], bs[4], gs[4];
+            _mm_store_ps(ts, t);
+            _mm_store_ps(bs, b);
+            _mm_store_ps(gs, g);
+            int lane = closestLane(mask, ts, bs, gs, 4 * k, tmax, beta, gamma);
+            if (lane >= 0) {
+                best = lane;
+            }
+        }
+    }
+    return best;
+}
+
+#endif // SIMD_KERNELS_SSE
+
+#if SIMD_KERNELS_AVX2
+
+// ====================================================================
+// AVX2
+// ====================================================================
+
+AVX2_TARGET static inline __m256
+load8(const float *lo, const float *hi) {
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_load_ps(lo)), _mm_load_ps(hi), 1);
+}
+
+AVX2_TARGET static int
+intersectTrianglesAVX2(const TrianglePacket4 *packets, int n_packets, const SimdRay &ray,
+                       float tmin, float &tmax, float &beta, float &gamma) {
+    __m256 ox = _mm256_set1_ps(ray.org[0]), oy = _mm256_set1_ps(ray.org[1]), oz = _mm256_set1_ps(ray.org[2]);
+    __m256 dx = _mm256_set1_ps(ray.dir[0]), dy = _mm256_set1_ps(ray.dir[1]), dz = _mm256_set1_ps(ray.dir[2]);
+    __m256 zero = _mm256_setzero_ps();
+    __m256 one = _mm256_set1_ps(1.f);
+    __m256 vtmin = _mm256_set1_ps(tmin);
+
+    int best = -1;
+    int k = 0;
+    for (; k + 1 < n_packets; k += 2) {
+        const TrianglePacket4 &lo = packets[k];
+        const TrianglePacket4 &hi = packets[k + 1];
+        __m256 e1x = load8(lo.e1[0], hi.e1[0]), e1y = load8(lo.e1[1], hi.e1[1]), e1z = load8(lo.e1[2], hi.e1[2]);
+        __m256 e2x = load8(lo.e2[0], hi.e2[0]), e2y = load8(lo.e2[1], hi.e2[1]), e2z = load8(lo.e2[2], hi.e2[2]);
+        __m256 sx = _mm256_sub_ps(ox, load8(lo.v0[0], hi.v0[0]));
+        __m256 sy = _mm256_sub_ps(oy, load8(lo.v0[1], hi.v0[1]));
+        __m256 sz = _mm256_sub_ps(oz, load8(lo.v0[2], hi.v0[2]));
+
+        __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+        __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+        __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+        __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)),
+                                   _mm256_mul_ps(e1z, pz));
+        __m256 invDet = _mm256_div_ps(one, det);
+
+        __m256 b = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, px), _mm256_mul_ps(sy, py)),
+                                               _mm256_mul_ps(sz, pz)), invDet);
+
+        __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+        __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+        __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+        __m256 g = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)),
+                                               _mm256_mul_ps(dz, qz)), invDet);
+        __m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)),
+                                               _mm256_mul_ps(e2z, qz)), invDet);
+
+        __m256 mask = _mm256_cmp_ps(det, zero, _CMP_NEQ_UQ);
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(b, zero, _CMP_GT_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(b, one, _CMP_LT_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(g, zero, _CMP_GT_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(b, g), one, _CMP_LT_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, vtmin, _CMP_GT_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, _mm256_set1_ps(tmax), _CMP_LT_OQ));
+
+        int bits = _mm256_movemask_ps(mask);
+        if (bits) {
+            alignas(32) float ts[8], bs[8], gs[8];
+            _mm256_store_ps(ts, t);
+            _mm256_store_ps(bs, b);
+            _mm256_store_ps(gs, g);
+            int lane = closestLane(bits, ts, bs, gs, 4 * k, tmax, beta, gamma);
+            if (lane >= 0) {
+                best = lane;
+            }
+        }
+    }
+
+    // An odd packet left over takes the 4-wide path.
+    if (k < n_packets) {
+        int lane = intersectTrianglesSSE(packets + k, 1, ray, tmin, tmax, beta, gamma);
+        if (lane >= 0) {
+            best = 4 * k + lane;
+        }
+    }
+    return best;
+}
+
+#endif // SIMD_KERNELS_AVX2
+
+static const SimdKernels scalar = {"scalar", intersectBoxes4Scalar, intersectTrianglesScalar};
+#if SIMD_KERNELS_SSE
+static const SimdKernels sse = {"sse", intersectBoxes4SSE, intersectTrianglesSSE};
+#endif
+#if SIMD_KERNELS_AVX2
+static const SimdKernels avx2 = {"avx2", intersectBoxes4SSE, intersectTrianglesAVX2};
+#endif
+
+const SimdKernels &
+selectSimdKernels() {
+#if SIMD_KERNELS_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return avx2;
+    }
+#endif
+#if SIMD_KERNELS_SSE
+    return sse;
+#else
+    return scalar;
+#endif
+}
@@ -0,0 +1,51 @@
+#ifndef SIMD_KERNELS_H
+#define SIMD_KERNELS_H
+
+// Ray-box and ray-triangle kernels that test one ray against several
+// primitives at once. The widest variant the CPU supports is picked at run
+// time; the scalar variants run anywhere.
+
+// Bounding boxes of four BVH children, one array per component.
+struct alignas(16) BoxPacket4 {
+    float mn[3][4];
+    float mx[3][4];
+};
+
+// Four triangles as a first vertex and two edges, one array per component.
+// Unused lanes have zero edges, which no ray can hit.
+struct alignas(16) TrianglePacket4 {
+    float v0[3][4];
+    float e1[3][4];
+    float e2[3][4];
+};
+
+// Ray in the form the kernels consume.
+struct SimdRay {
+    float org[3];
+    float dir[3];
+    float invDir[3];
+};
+
+// Tests four boxes against the interval [tmin, tmax]. Returns a bit mask of
+// the boxes hit and writes their entry distances to tnear.
+typedef int (*IntersectBoxes4Fn)(const BoxPacket4 &boxes, const SimdRay &ray,
+                                 float tmin, float tmax, float tnear[4]);
+
+// Tests n_packets consecutive triangle packets for hits with tmin < t < tmax.
+// Returns the lane (4 * packet + lane) of the closest one and narrows tmax to
+// it, or returns -1. beta and gamma get the barycentric weights of the
+// second and third vertices.
+typedef int (*IntersectTrianglesFn)(const TrianglePacket4 *packets, int n_packets, const SimdRay &ray,
+                                    float tmin, float &tmax, float &beta, float &gamma);
+
+struct SimdKernels {
+    const char *name;
+    IntersectBoxes4Fn intersectBoxes4;
+    IntersectTrianglesFn intersectTriangles;
+};
+
+// AVX2 tests two triangle packets (8 triangles) per step, SSE one packet.
+// Boxes are tested four at a time by both.
+const SimdKernels &selectSimdKernels();
+
+#endif // SIMD_KERNELS_H
@@ -4,6 +4,7 @@
 #include <vecmath.h>
 
 #include <algorithm>
+#include <cmath>
 
 class VecUtils {
 public:
@@ -43,6 +44,16 @@ public:
         return out;
     }
 
+    // Perceived brightness of a color (Rec. 709 weights).
+    static float luminance(const Vector3f &c) {
+        return 0.2126f * c[0] + 0.7152f * c[1] + 0.0722f * c[2];
+    }
+
+    // Whether no component is infinite or NaN.
+    static bool isFinite(const Vector3f &c) {
+        return std::isfinite(c[0]) && std::isfinite(c[1]) && std::isfinite(c[2]);
+    }
+
     // Transforms a 3D point using a matrix, returning a 3D point.
     static Vector3f transformPoint(const Matrix4f &mat,
                                    const Vector3f &point) {
@@ -0,0 +1,258 @@
+#include "WideBVH.h"
+
+#include "Mesh.h"
+
+#include <algorithm>
+#include <limits>
+
+void
+WideBVH::build(const Mesh &mesh) {
+    _kernels = &selectSimdKernels();
+    _nodes.clear();
+    _packets.clear();
+    _trigIndices.clear();
+
+    std::vector<BVHBuilder::Primitive> prims(mesh.getNumTriangles());
+    for (int ii = 0; ii < mesh.getNumTriangles(); ii++) {
+        Box box;
+        for (int vi = 0; vi < 3; vi++) {
+            box.extend(mesh.getVertex(ii, vi));
+        }
+        prims[ii].box = box;
+        prims[ii].centroid = box.center();
+        prims[ii].index = ii;
+    }
+
+    std::unique_ptr<BVHBuilder::BuildNode> root = BVHBuilder(max_leaf, 4).build(prims);
+    if (root) {
+        flatten(root.get(), prims, mesh);
+    }
+
+    _nodeData = _nodes.data();
+    _numNodes = _nodes.size();
+    _packetData = _packets.data();
+    _numPackets = _packets.size();
+    _trigIndexData = _trigIndices.data();
+}
+
+void
+WideBVH::attach(const void *nodes, size_t n_nodes, const void *packets, size_t n_packets,
+                const int32_t *trigIndices) {
+    _kernels = &selectSimdKernels();
+    _nodes.clear();
+    _packets.clear();
+    _trigIndices.clear();
+
+    _nodeData = (const Node *) nodes;
+    _numNodes = n_nodes;
+    _packetData = (const TrianglePacket4 *) packets;
+    _numPackets = n_packets;
+    _trigIndexData = trigIndices;
+}
+
+int
+WideBVH::flatten(const BVHBuilder::BuildNode *node, const std::vector<BVHBuilder::Primitive> &prims,
+                 const Mesh &mesh) {
+    // Collapse the binary tree: keep opening the largest interior child
+    // until the node has four children. A leaf root becomes a node with a
+    // single child.
+    std::vector<const BVHBuilder::BuildNode *> children;
+    if (node->count > 0) {
+        children.push_back(node);
+    } else {
+        children.push_back(node->child[0].get());
+        children.push_back(node->child[1].get());
+    }
+    while (children.size() < 4) {
+        int largest = -1;
+        float largestArea = -1;
+        for (size_t ii = 0; ii < children.size(); ii++) {
+            float area = children[ii]->box.surfaceArea();
+            if (children[ii]->count == 0 && area > largestArea) {
+                largest = (int) ii;
+                largestArea = area;
+            }
+        }
+        if (largest < 0) {
+            break;
+        }
+        const BVHBuilder::BuildNode *opened = children[largest];
+        children[largest] = opened->child[0].get();
+        children.push_back(opened->child[1].get());
+    }
+
+    int index = (int) _nodes.size();
+    _nodes.emplace_back();
+    Node empty = Node();
+    for (int lane = 0; lane < 4; lane++) {
+        for (int dim = 0; dim < 3; dim++) {
+            empty.boxes.mn[dim][lane] = std::numeric_limits<float>::infinity();
+            empty.boxes.mx[dim][lane] = std::numeric_limits<float>::infinity();
+        }
+    }
+    _nodes[index] = empty;
+
+    // Children are written by index, since flattening them grows the array.
+    for (size_t lane = 0; lane < children.size(); lane++) {
+        const BVHBuilder::BuildNode *child = children[lane];
+        int32_t code;
+        uint8_t n_packets = 0;
+        if (child->count > 0) {
+            code = emitLeaf(child, prims, mesh);
+            n_packets = (uint8_t) ((child->count + 3) / 4);
+        } else {
+            code = flatten(child, prims, mesh);
+        }
+
+        Node &n = _nodes[index];
+        for (int dim = 0; dim < 3; dim++) {
+            n.boxes.mn[dim][lane] = child->box.mn[dim];
+            n.boxes.mx[dim][lane] = child->box.mx[dim];
+        }
+        n.child[lane] = code;
+        n.n_packets[lane] = n_packets;
+    }
+    return index;
+}
+
+int32_t
+WideBVH::emitLeaf(const BVHBuilder::BuildNode *leaf, const std::vector<BVHBuilder::Primitive> &prims,
+                  const Mesh &mesh) {
+    int32_t first = (int32_t) _packets.size();
+    for (int base = 0; base < leaf->count; base += 4) {
+        TrianglePacket4 packet = TrianglePacket4();
+        for (int lane = 0; lane < 4; lane++) {
+            if (base + lane >= leaf->count) {
+                // Zero edges never produce a hit.
+                _trigIndices.push_back(-1);
+                continue;
+            }
+            int trig = prims[leaf->first + base + lane].index;
+            const Vector3f &v0 = mesh.getVertex(trig, 0);
+            Vector3f e1 = mesh.getVertex(trig, 1) - v0;
+            Vector3f e2 = mesh.getVertex(trig, 2) - v0;
+            for (int dim = 0; dim < 3; dim++) {
+                packet.v0[dim][lane] = v0[dim];
+                packet.e1[dim][lane] = e1[dim];
+                packet.e2[dim][lane] = e2[dim];
+            }
+            _trigIndices.push_back(trig);
+        }
+        _packets.push_back(packet);
+    }
+    return ~first;
+}
+
+bool
+WideBVH::intersect(const Ray &r, float tmin, float &tmax, int &trig, float &beta, float &gamma) const {
+    if (_numNodes == 0) {
+        return false;
+    }
+
+    SimdRay ray;
+    const Vector3f origin = r.getOrigin();
+    const Vector3f dir = r.getDirection();
+    for (int dim = 0; dim < 3; dim++) {
+        ray.org[dim] = origin[dim];
+        ray.dir[dim] = dir[dim];
+        ray.invDir[dim] = 1 / dir[dim];
+    }
+
+    struct Entry {
+        int32_t child;
+        int32_t n_packets;
+        float tnear;
+    };
+    // Up to three siblings wait on the stack per level of the tree.
+    Entry stack[256];
+    int top = 0;
+    stack[top++] = {0, 0, tmin};
+
+    bool result = false;
+    while (top > 0) {
+        Entry entry = stack[--top];
+        if (entry.tnear > tmax) {
+            continue;
+        }
+
+        if (entry.child < 0) {
+            int first = ~entry.child;
+            int lane = _kernels->intersectTriangles(&_packetData[first], entry.n_packets, ray, tmin, tmax, beta, gamma);
+            if (lane >= 0) {
+                trig = _trigIndexData[4 * first + lane];
+                result = true;
+            }
+            continue;
+        }
+
+        const Node &node = _nodeData[entry.child];
+        float tnear[4];
+        int mask = _kernels->intersectBoxes4(node.boxes, ray, tmin, tmax, tnear);
+
+        // Push the children hit far to near, so the nearest is popped first.
+        Entry hits[4];
+        int n_hits = 0;
+        for (int lane = 0; lane < 4; lane++) {
+            if (mask & (1 << lane)) {
+                Entry e = {node.child[lane], node.n_packets[lane], tnear[lane]};
+                int pos = n_hits++;
+                while (pos > 0 && hits[pos - 1].tnear < e.tnear) {
+                    hits[pos] = hits[pos - 1];
+                    pos--;
+                }
+                hits[pos] = e;
+            }
+        }
+        for (int ii = 0; ii < n_hits; ii++) {
+            stack[top++] = hits[ii];
+        }
+    }
+    return result;
+}
+
+bool
+WideBVH::occluded(const Ray &r, float tmin, float tmax) const {
+    if (_numNodes == 0) {
+        return false;
+    }
+
+    SimdRay ray;
+    const Vector3f origin = r.getOrigin();
+    const Vector3f dir = r.getDirection();
+    for (int dim = 0; dim < 3; dim++) {
+        ray.org[dim] = origin[dim];
+        ray.dir[dim] = dir[dim];
+        ray.invDir[dim] = 1 / dir[dim];
+    }
+
+    // Any hit ends the search, so children are pushed unsorted and the
+    // distance bound never shrinks.
+    int32_t stack[256];
+    uint8_t stackPackets[256];
+    int top = 0;
+    stack[top] = 0;
+    stackPackets[top++] = 0;
+
+    while (top > 0) {
+        top--;
+        int32_t child = stack[top];
+        if (child < 0) {
+            float t = tmax, beta, gamma;
+            if (_kernels->intersectTriangles(&_packetData[~child], stackPackets[top], ray, tmin, t, beta, gamma) >= 0) {
+                return true;
+            }
+            continue;
+        }
+
+        const Node &node = _nodeData[child];
+        float tnear[4];
+        int mask = _kernels->intersectBoxes4(node.boxes, ray, tmin, tmax, tnear);
+        for (int lane = 0; lane < 4; lane++) {
+            if (mask & (1 << lane)) {
+                stack[top] = node.child[lane];
+                stackPackets[top++] = node.n_packets[lane];
+            }
+        }
+    }
+    return false;
+}
@@ -0,0 +1,116 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include "AlignedAllocator.h"
+#include "Box.h"
+#include "BVH.h"
+#include "Ray.h"
+#include "SimdKernels.h"
+
+#include <cstdint>
+#include <vector>
+
+class Mesh;
+
+// Four-wide BVH over the triangles of a mesh. Each node holds the boxes of
+// its four children side by side so one kernel call tests them all, and
+// leaves hold up to two packets of four triangles. The kernels are picked
+// for the running CPU when the tree is built or attached.
+class WideBVH {
+public:
+    WideBVH() :
+            _kernels(nullptr),
+            _nodeData(nullptr),
+            _numNodes(0),
+            _packetData(nullptr),
+            _numPackets(0),
+            _trigIndexData(nullptr) {}
+
+    void build(const Mesh &mesh);
+
+    // Uses arrays made by an earlier build, as getNodeData and friends
+    // return them, instead of building the tree. The memory is used in
+    // place: it must outlive the tree and be 64-byte aligned. Triangle
+    // indices come four per packet.
+    void attach(const void *nodes, size_t n_nodes, const void *packets, size_t n_packets,
+                const int32_t *trigIndices);
+
+    // Bytes of one node in the array getNodeData returns.
+    static size_t nodeSize() {
+        return sizeof(Node);
+    }
+
+    const void *getNodeData() const {
+        return _nodeData;
+    }
+
+    const void *getPacketData() const {
+        return _packetData;
+    }
+
+    const int32_t *getTrigIndexData() const {
+        return _trigIndexData;
+    }
+
+    // Closest triangle with tmin < t < tmax. On a hit, narrows tmax and
+    // returns the triangle index with its barycentric weights.
+    bool intersect(const Ray &r, float tmin, float &tmax, int &trig, float &beta, float &gamma) const;
+
+    // Any triangle with tmin < t < tmax.
+    bool occluded(const Ray &r, float tmin, float tmax) const;
+
+    const char *getKernelName() const {
+        return _kernels ? _kernels->name : "none";
+    }
+
+    size_t getNumNodes() const {
+        return _numNodes;
+    }
+
+    size_t getNumPackets() const {
+        return _numPackets;
+    }
+
+    // Bytes of the node, packet and triangle index arrays.
+    size_t memoryUsage() const {
+        return sizeof(Node) * _numNodes + (sizeof(TrianglePacket4) + 4 * sizeof(int32_t)) * _numPackets;
+    }
+
+private:
+    // 128 bytes, two cache lines. A child is a node index if non-negative,
+    // else ~(first packet) of a leaf with n_packets[lane] packets. Unused
+    // lanes have boxes at +infinity, which no ray reaches.
+    struct Node {
+        BoxPacket4 boxes;
+        int32_t child[4];
+        uint8_t n_packets[4];
+        uint8_t pad[12];
+    };
+
+    static_assert(sizeof(Node) == 128, "wide BVH nodes should fill two cache lines");
+
+    int flatten(const BVHBuilder::BuildNode *node, const std::vector<BVHBuilder::Primitive> &prims,
+                const Mesh &mesh);
+
+    int32_t emitLeaf(const BVHBuilder::BuildNode *leaf, const std::vector<BVHBuilder::Primitive> &prims,
+                     const Mesh &mesh);
+
+    // A leaf fills at most two packets.
+    static const int max_leaf = 8;
+
+    const SimdKernels *_kernels;
+    // Arrays filled by build.
+    std::vector<Node, AlignedAllocator<Node>> _nodes;
+    std::vector<TrianglePacket4, AlignedAllocator<TrianglePacket4>> _packets;
+    std::vector<int32_t> _trigIndices;
+
+    // Arrays traversed: the vectors above, or attached memory.
+    const Node *_nodeData;
+    size_t _numNodes;
+    const TrianglePacket4 *_packetData;
+    size_t _numPackets;
+    // Mesh triangle of every packet lane, -1 for padding.
+    const int32_t *_trigIndexData;
+};
+
+#endif // WIDE_BVH_H
@@ -5,6 +5,7 @@
 
 #include "ArgParser.h"
 #include "Renderer.h"
+#include "Server.h"
 
 
 
@@ -55,6 +56,24 @@ void logProgramOutput(const ArgParser &argParser,
     logging << "- height: " << argParser.height << std::endl;
     logging << "- iters: " << argParser.iters << std::endl;
     logging << "- length: " << argParser.length << std::endl;
+    logging << "- seed: " << argParser.seed << std::endl;
+    logging << "- sampler: " << argParser.sampler << std::endl;
+    logging << "- mode: " << argParser.mode << std::endl;
+    logging << "- chains: " << argParser.chains << std::endl;
+    logging << "- bootstrap: " << argParser.bootstrap << std::endl;
+    logging << "- temperatures: " << argParser.temperatures << std::endl;
+    logging << "- pass: " << argParser.pass << std::endl;
+    logging << "- snapshot: " << argParser.snapshot << "s, " << argParser.snapshot_passes << " passes" << std::endl;
+    logging << "- time: " << argParser.time << std::endl;
+    logging << "- target-rel-error: " << argParser.target_rel_error << std::endl;
+    logging << "- adaptive: " << argParser.adaptive << std::endl;
+    logging << "- checkpoint: " << argParser.checkpoint_file << std::endl;
+    logging << "- resume: " << argParser.resume_file << std::endl;
+    for (const std::string &file : argParser.merge_files) {
+        logging << "- merge: " << file << std::endl;
+    }
+    logging << "- shard: " << argParser.shard_index << "/" << argParser.shard_count << std::endl;
+    logging << "- tile: " << argParser.tile_size << " (" << argParser.tile_order << ")" << std::endl;
     logging << "- log: " << argParser.log_file << std::endl;
     logging << "[END TIME: " << stopTimeBuffer << "]\n";
     logging << "Total Duration: " << durationString << "\n\n";
@@ -73,7 +92,28 @@ main(int argc, const char *argv[]) {
                   << "\t-output <image.png>\n"
                   << "\t[-iters <iterations>]\n"
                   << "\t[-length <path_lengths>]\n"
+                  << "\t[-seed <seed>]\n"
+                  << "\t[-sampler <random|sobol|halton|rank1>]\n"
+                  << "\t[-mode <bdpt|pssmlt|mmlt>]\n"
+                  << "\t[-chains <metropolis_chains>]\n"
+                  << "\t[-bootstrap <metropolis_bootstrap_samples>]\n"
+                  << "\t[-temperatures <metropolis_replicas_per_chain>]\n"
+                  << "\t[-pass <samples_per_pixel_per_pass>]\n"
+                  << "\t[-snapshot <seconds_between_snapshots>]\n"
+                  << "\t[-snapshot-passes <passes_between_snapshots>]\n"
+                  << "\t[-time <seconds>]\n"
+                  << "\t[-target-rel-error <relative_error>]\n"
+                  << "\t[-adaptive <tile_relative_error>]\n"
+                  << "\t[-checkpoint <checkpoint_out>]\n"
+                  << "\t[-resume <checkpoint_in>]\n"
+                  << "\t[-merge <checkpoint_in>]...\n"
+                  << "\t[-shard <k>/<N>]\n"
+                  << "\t[-tile <tile_size>]\n"
+                  << "\t[-tile-order <scanline|morton|hilbert|center>]\n"
                   << "\t[-log <log.txt>]\n"
+                  << "\t[-camera <center_xyz> <direction_xyz> <up_xyz> <angle_degrees>]\n"
+                  << "\n"
+                  << "Daemon: a5 --serve <socket>\n"
                   << "\n";
         return 1;
     }
@@ -81,8 +121,15 @@ main(int argc, const char *argv[]) {
     // Record the start and end time of the program to be saved later.
     auto start = std::chrono::system_clock::now();
     ArgParser argsParser(argc, argv);
+    if (!argsParser.serve_socket.empty()) {
+        return serve(argsParser.serve_socket);
+    }
     Renderer renderer(argsParser);
-    renderer.Render();
+    std::string error;
+    if (!renderer.Render(error)) {
+        std::cout << error << "\n";
+        return 1;
+    }
     auto stop = std::chrono::system_clock::now();
 
     // Get the overall duration to print out.
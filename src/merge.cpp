@@ -0,0 +1,66 @@
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Checkpoint.h"
+#include "Image.h"
+
+// Combines checkpoints of one render, such as the shards written by
+// metrocaster -shard k/N, into the final image and, optionally, one
+// checkpoint that a later render can resume or merge.
+int
+main(int argc, const char *argv[]) {
+    std::string output_file;
+    std::string checkpoint_file;
+    std::vector<std::string> inputs;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-output") && i + 1 < argc) {
+            output_file = argv[++i];
+        } else if (!strcmp(argv[i], "-checkpoint") && i + 1 < argc) {
+            checkpoint_file = argv[++i];
+        } else if (argv[i][0] == '-') {
+            printf("Unknown command line argument %d: '%s'\n", i, argv[i]);
+            return 1;
+        } else {
+            inputs.push_back(argv[i]);
+        }
+    }
+
+    if (inputs.empty() || (output_file.empty() && checkpoint_file.empty())) {
+        std::cout << "Usage: metrocaster-merge <args> <checkpoint>...\n"
+                  << "\n"
+                  << "Args:\n"
+                  << "\t[-output <image.png>]\n"
+                  << "\t[-checkpoint <merged_checkpoint>]\n"
+                  << "\n";
+        return 1;
+    }
+
+    Checkpoint merged;
+    std::string error;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        Checkpoint checkpoint;
+        if (!checkpoint.load(inputs[i], error)) {
+            printf("%s\n", error.c_str());
+            return 1;
+        }
+        if (i == 0) {
+            merged = checkpoint;
+        } else if (!merged.merge(checkpoint, error)) {
+            printf("Could not merge '%s': %s\n", inputs[i].c_str(), error.c_str());
+            return 1;
+        }
+    }
+
+    if (!output_file.empty()) {
+        AccumulationImage film(merged.width, merged.height);
+        film.addFloats(merged.film);
+        film.resolve().savePNG(output_file);
+    }
+    if (!checkpoint_file.empty() && !merged.save(checkpoint_file)) {
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,173 @@
+// Checks the OBJ parser against strtof and against a line-by-line reading
+// of the same text. The test builds the parser with chunks of a few dozen
+// bytes, so faces refer to vertices in earlier chunks.
+
+#include "ObjParser.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+static void
+check(bool ok, const char *what) {
+    if (!ok) {
+        printf("%s  FAILED\n", what);
+        failures++;
+    }
+}
+
+static bool
+parse(const std::string &text, ObjGeometry &geometry) {
+    return parseObj(text.data(), text.size(), "test.obj", geometry);
+}
+
+static bool
+sameBits(float a, float b) {
+    return memcmp(&a, &b, sizeof(float)) == 0;
+}
+
+static void
+testCorners() {
+    ObjGeometry geometry;
+    bool ok = parse("v 0 0 0\nv 1 0 0\nv 0 1 0\nv 0 0 1\n"
+                    "f 1//1 2//1 3//1\n"
+                    "f 2/1/1 3/2/1 4/3/1\n"
+                    "f 1/1 3/2 4/3\n", geometry);
+    std::vector<int> expected = {0, 1, 2, 1, 2, 3, 0, 2, 3};
+    check(ok && geometry.vertices.size() == 4 && geometry.indices == expected, "v//vn, v/vt/vn and v/vt corners");
+}
+
+static void
+testFan() {
+    ObjGeometry geometry;
+    bool ok = parse("v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nv -1 1 0\n"
+                    "f 1 2 3 4 5\n", geometry);
+    std::vector<int> expected = {0, 1, 2, 0, 2, 3, 0, 3, 4};
+    check(ok && geometry.indices == expected, "polygon fan");
+}
+
+static void
+testRelativeAcrossChunks() {
+    // The comments push the face several chunks past the vertices, into a
+    // chunk that has none of its own.
+    std::string text;
+    for (int i = 0; i < 8; i++) {
+        text += "v " + std::to_string(i) + " 0 0\n";
+    }
+    for (int i = 0; i < 8; i++) {
+        text += "# a comment long enough to fill most of a chunk by itself\n";
+    }
+    text += "f -8 -4 -1\nf 1 -7 -2\n";
+    check(text.size() > 4 * OBJ_CHUNK_BYTES, "relative test spans chunks");
+
+    ObjGeometry geometry;
+    bool ok = parse(text, geometry);
+    std::vector<int> expected = {0, 4, 7, 0, 1, 6};
+    check(ok && geometry.indices == expected, "negative indices to vertices in earlier chunks");
+}
+
+static void
+testBadIndices() {
+    const char *faces[] = {"f 0 1 2\n", "f 1 2 4\n", "f -4 1 2\n", "f 1 2 x\n"};
+    for (const char *face : faces) {
+        ObjGeometry geometry;
+        std::string text = std::string("v 0 0 0\nv 1 0 0\nv 0 1 0\n") + face;
+        check(!parse(text, geometry), face);
+    }
+}
+
+static void
+testRounding() {
+    // Rounding in double and then to float gives 0.0096784122 for the
+    // first; strtof gives 0.0096784113.
+    std::vector<std::string> words = {"9.67841176316142e-03", "16777217", "1.6777217e7", "8388609.5",
+                                      "0.1234567890123456789", "1e-40", "3.4e38", "-0", "+2.5", ".5", "5.",
+                                      "1E+2", "1e10", "1e-10", "123456789e-15", "nan", "-inf"};
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<double> uniform(-1, 1);
+    const char *formats[] = {"%.6f", "%.9g", "%.15e", "%.20f", "%.3e", "%.17g"};
+    for (int i = 0; i < 30000; i++) {
+        char word[64];
+        double scale = std::pow(10.0, (int) (rng() % 13) - 6);
+        snprintf(word, sizeof(word), formats[rng() % 6], uniform(rng) * scale);
+        words.push_back(word);
+    }
+
+    std::string text;
+    for (size_t i = 0; i < words.size(); i += 3) {
+        text += "v " + words[i] + " " + words[(i + 1) % words.size()] + " " + words[(i + 2) % words.size()] + "\n";
+    }
+    ObjGeometry geometry;
+    bool ok = parse(text, geometry) && geometry.vertices.size() == (words.size() + 2) / 3;
+    for (size_t i = 0; ok && i < words.size(); i++) {
+        float expected = strtof(words[i].c_str(), nullptr);
+        float got = geometry.vertices[i / 3][i % 3];
+        if (!sameBits(got, expected) && !(expected != expected && got != got)) {
+            printf("'%s' parses to %.9g, strtof gives %.9g\n", words[i].c_str(), got, expected);
+            ok = false;
+        }
+    }
+    check(ok, "coordinates round as strtof does");
+}
+
+static void
+testRandomFile() {
+    // Vertices, faces of three to six corners in every corner form with
+    // absolute and relative indices, and other records, against a reading
+    // of one line at a time.
+    std::mt19937 rng(5);
+    std::string text;
+    std::vector<int> expected;
+    int n_vertices = 0;
+    const char *suffixes[] = {"", "/1", "//2", "/3/4"};
+    const char *ends[] = {"\n", "\r\n", " \n"};
+    const char *others[] = {"# c\n", "vt 0 1\n", "vn 0 0 1\n", "o x\n", "g y\n", "s 1\n", "\n"};
+    for (int line = 0; line < 5000; line++) {
+        unsigned r = rng() % 10;
+        if (n_vertices < 3 || r < 5) {
+            text += "v " + std::to_string((int) (rng() % 100)) + ".5 1 -2" + ends[rng() % 3];
+            n_vertices++;
+        } else if (r < 9) {
+            int n_corners = 3 + rng() % 4;
+            std::vector<int> corners;
+            text += rng() % 2 ? "f" : "f\t";
+            for (int k = 0; k < n_corners; k++) {
+                int index = rng() % n_vertices;
+                corners.push_back(index);
+                int written = rng() % 2 ? index + 1 : index - n_vertices;
+                text += " " + std::to_string(written) + suffixes[rng() % 4];
+            }
+            text += ends[rng() % 3];
+            for (int k = 1; k + 1 < n_corners; k++) {
+                expected.push_back(corners[0]);
+                expected.push_back(corners[k]);
+                expected.push_back(corners[k + 1]);
+            }
+        } else {
+            text += others[rng() % 7];
+        }
+    }
+
+    ObjGeometry geometry;
+    bool ok = parse(text, geometry);
+    check(ok && (int) geometry.vertices.size() == n_vertices && geometry.indices == expected,
+          "random file read in chunks");
+}
+
+int
+main() {
+    testCorners();
+    testFan();
+    testRelativeAcrossChunks();
+    testBadIndices();
+    testRounding();
+    testRandomFile();
+    printf("%s\n", failures == 0 ? "all OBJ parser checks passed" : "OBJ parser checks FAILED");
+    return failures == 0 ? 0 : 1;
+}
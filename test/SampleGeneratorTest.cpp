@@ -0,0 +1,67 @@
+// Checks each sample pattern against independent random numbers on simple
+// integrands. A pattern whose dimensions are correlated gets a biased
+// estimate, which shows as a larger error than random sampling's.
+
+#include "SampleGenerator.h"
+
+#include <cmath>
+#include <cstdio>
+
+static const int n_pixels = 16;
+static const int n_samples = 256;
+static const int n_dims = 24;
+
+// Root mean square error, over pixels and integrands, of estimates of the
+// products x_a * x_b of two dimensions. Every product integrates to 1/4.
+static double
+productError(SamplePattern pattern) {
+    std::unique_ptr<SampleGenerator> gen = createSampleGenerator(pattern, 7);
+    double sumSquares = 0;
+    int n_estimates = 0;
+    for (int py = 0; py < n_pixels; py++) {
+        for (int px = 0; px < n_pixels; px++) {
+            double sums[n_dims][n_dims] = {};
+            for (int i = 0; i < n_samples; i++) {
+                gen->startSample(px, py, i);
+                gen->startBlock(0, n_dims);
+                double x[n_dims];
+                for (int d = 0; d < n_dims; d++) {
+                    x[d] = gen->get1D();
+                }
+                for (int a = 0; a < n_dims; a++) {
+                    for (int b = a + 1; b < n_dims; b++) {
+                        sums[a][b] += x[a] * x[b];
+                    }
+                }
+            }
+            for (int a = 0; a < n_dims; a++) {
+                for (int b = a + 1; b < n_dims; b++) {
+                    double error = sums[a][b] / n_samples - 0.25;
+                    sumSquares += error * error;
+                    n_estimates++;
+                }
+            }
+        }
+    }
+    return std::sqrt(sumSquares / n_estimates);
+}
+
+int
+main() {
+    const char *names[] = {"random", "sobol", "halton", "rank1"};
+    double baseline = 0;
+    int failures = 0;
+    for (const char *name : names) {
+        SamplePattern pattern;
+        samplePatternFromName(name, pattern);
+        double error = productError(pattern);
+        if (pattern == SamplePattern::Random) {
+            baseline = error;
+        }
+        // Independent dimensions do no worse than random numbers.
+        bool ok = error <= 1.25 * baseline;
+        printf("%-7s rms error %.5f%s\n", name, error, ok ? "" : "  FAILED");
+        failures += ok ? 0 : 1;
+    }
+    return failures == 0 ? 0 : 1;
+}